@@ -8,10 +8,16 @@ C_SRCS += \
 ../source/accelerometer.c \
 ../source/cbfifo.c \
 ../source/cmd_processor.c \
+../source/detector.c \
+../source/filter.c \
 ../source/i2c.c \
 ../source/mtb.c \
+../source/nvstore.c \
+../source/power.c \
 ../source/rgb_led.c \
 ../source/semihost_hardfault.c \
+../source/spectrum.c \
+../source/stats.c \
 ../source/sysclock.c \
 ../source/timers.c \
 ../source/uart.c 
@@ -21,10 +27,16 @@ C_DEPS += \
 ./source/accelerometer.d \
 ./source/cbfifo.d \
 ./source/cmd_processor.d \
+./source/detector.d \
+./source/filter.d \
 ./source/i2c.d \
 ./source/mtb.d \
+./source/nvstore.d \
+./source/power.d \
 ./source/rgb_led.d \
 ./source/semihost_hardfault.d \
+./source/spectrum.d \
+./source/stats.d \
 ./source/sysclock.d \
 ./source/timers.d \
 ./source/uart.d 
@@ -34,10 +46,16 @@ OBJS += \
 ./source/accelerometer.o \
 ./source/cbfifo.o \
 ./source/cmd_processor.o \
+./source/detector.o \
+./source/filter.o \
 ./source/i2c.o \
 ./source/mtb.o \
+./source/nvstore.o \
+./source/power.o \
 ./source/rgb_led.o \
 ./source/semihost_hardfault.o \
+./source/spectrum.o \
+./source/stats.o \
 ./source/sysclock.o \
 ./source/timers.o \
 ./source/uart.o 
@@ -55,7 +73,7 @@ source/%.o: ../source/%.c source/subdir.mk
 clean: clean-source
 
 clean-source:
-	-$(RM) ./source/PES_Final_Project.d ./source/PES_Final_Project.o ./source/accelerometer.d ./source/accelerometer.o ./source/cbfifo.d ./source/cbfifo.o ./source/cmd_processor.d ./source/cmd_processor.o ./source/i2c.d ./source/i2c.o ./source/mtb.d ./source/mtb.o ./source/rgb_led.d ./source/rgb_led.o ./source/semihost_hardfault.d ./source/semihost_hardfault.o ./source/sysclock.d ./source/sysclock.o ./source/timers.d ./source/timers.o ./source/uart.d ./source/uart.o
+	-$(RM) ./source/PES_Final_Project.d ./source/PES_Final_Project.o ./source/accelerometer.d ./source/accelerometer.o ./source/cbfifo.d ./source/cbfifo.o ./source/cmd_processor.d ./source/cmd_processor.o ./source/detector.d ./source/detector.o ./source/filter.d ./source/filter.o ./source/i2c.d ./source/i2c.o ./source/mtb.d ./source/mtb.o ./source/nvstore.d ./source/nvstore.o ./source/power.d ./source/power.o ./source/rgb_led.d ./source/rgb_led.o ./source/semihost_hardfault.d ./source/semihost_hardfault.o ./source/spectrum.d ./source/spectrum.o ./source/stats.d ./source/stats.o ./source/sysclock.d ./source/sysclock.o ./source/timers.d ./source/timers.o ./source/uart.d ./source/uart.o
 
 .PHONY: clean-source
 
@@ -0,0 +1,55 @@
+/**
+ * @file MKL25Z4.h
+ * @brief Host stand-in for the device header
+ *
+ * This h file lets the hardware independent modules
+ * build on the host for the host tests. PRIMASK is a
+ * variable, and the test decides which simulated
+ * interrupts arrive while it is set, and runs them once
+ * it is cleared, as the NVIC would.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#ifndef MKL25Z4_H_
+#define MKL25Z4_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Get PRIMASK
+ *
+ * @return 1 if interrupts are masked, 0 otherwise
+ */
+uint32_t __get_PRIMASK(void);
+
+/**
+ * @brief Set PRIMASK. Clearing it runs the simulated interrupts that
+ *        arrived while it was set.
+ *
+ * @param primask - 1 to mask interrupts, 0 to unmask them
+ *
+ * @return none
+ */
+void __set_PRIMASK(uint32_t primask);
+
+/**
+ * @brief Mask interrupts. A simulated interrupt may arrive meanwhile,
+ *        it stays pending until PRIMASK is cleared.
+ *
+ * @return none
+ */
+void __disable_irq(void);
+
+/**
+ * @brief Data memory barrier, the host test runs in a single thread
+ *
+ * @return none
+ */
+static inline void __DMB(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+} // __DMB()
+
+#endif /* MKL25Z4_H_ */
@@ -0,0 +1,324 @@
+/**
+ * @file cbfifo_host_test.c
+ * @brief Host test of the multiple producer circular buffer
+ *
+ * This c file drives a shared circular buffer from
+ * simulated nested interrupts on the host. Producers in
+ * the main loop and at two interrupt priorities write
+ * messages the way uart_printf() and __sys_write() do,
+ * and a consumer at the UART priority drains them. Any
+ * simulated interrupt may arrive between any two steps
+ * of a producer, and one that arrives while interrupts
+ * are masked runs as soon as they are unmasked. Every
+ * message must come out whole and exactly once.
+ *
+ * Build and run from PES_Final_Project:
+ * gcc -DDEBUG -Ihost_test -Isource host_test/cbfifo_host_test.c source/cbfifo.c -o cbfifo_host_test && ./cbfifo_host_test
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "MKL25Z4.h"
+#include "timers.h"
+#include "cbfifo.h"
+
+
+#define QUEUE_LENGTH    (256)    // Capacity of the shared queue in bytes, as uart_tx_cbfifo
+#define LINE_LENGTH     (48)     // Space claimed for each in place message
+#define MAX_PAYLOAD     (32)     // Longest message payload
+#define ITERATIONS      (200000) // Passes of the simulated main loop
+#define MAX_MESSAGES    (2000000) // Messages that can be tracked
+#define LEVEL_MAIN      (3)      // Priority of the main loop, lowest
+#define LEVEL_UART      (2)      // Priority of the UART interrupt, consumer and producer
+#define LEVEL_I2C       (1)      // Priority of the I2C interrupt, producer, highest
+#define PAD             ('\0')   // Unused claimed space that couldn't be given back
+
+CBFIFO_DEFINE(queue, char, QUEUE_LENGTH);
+
+static uint32_t primask = 0;             // Simulated PRIMASK
+static uint8_t  pending = 0;             // Bit per simulated interrupt level waiting for PRIMASK to clear
+static int      level = LEVEL_MAIN;      // Priority of the running context
+static uint32_t random_state = 12345;    // Pseudo-random sequence, fixed so runs repeat
+static uint32_t next_id = 0;             // Id of the next message
+static uint32_t sent = 0;                // Messages published
+static uint32_t dropped = 0;             // Messages that didn't fit in the queue
+static uint32_t received = 0;            // Messages parsed from the consumer output
+static uint32_t preemptions = 0;         // Simulated interrupts that ran
+static uint32_t deferred = 0;            // Simulated interrupts held off by PRIMASK
+static uint8_t  seen[MAX_MESSAGES];      // Set for each message id received
+static char     output[4 * QUEUE_LENGTH]; // Consumer output not yet parsed
+static size_t   output_length = 0;
+
+static void preempt_point();
+
+
+/**
+ * @brief Get TIMER_Ticks() for the cbfifo benchmark
+ *
+ * @return A count that advances on every call
+ */
+uint32_t TIMER_Ticks() {
+	static uint32_t ticks = 0;
+
+	return ticks += 8;
+} // TIMER_Ticks()
+
+/**
+ * @brief Get the next pseudo-random number
+ *
+ * @return Pseudo-random number from 0 to 32767
+ */
+static uint32_t random_next() {
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) & 0x7FFF;
+} // random_next()
+
+/**
+ * @brief Get PRIMASK
+ *
+ * @return 1 if interrupts are masked, 0 otherwise
+ */
+uint32_t __get_PRIMASK(void) {
+	return primask;
+} // __get_PRIMASK()
+
+/**
+ * @brief Run a simulated interrupt, on top of the running context
+ *
+ * @param irq_level - Priority of the interrupt
+ *
+ * @return none
+ */
+static void run_interrupt(int irq_level);
+
+/**
+ * @brief Set PRIMASK. Clearing it runs the simulated interrupts that
+ *        arrived while it was set, highest priority first.
+ *
+ * @param mask - 1 to mask interrupts, 0 to unmask them
+ *
+ * @return none
+ */
+void __set_PRIMASK(uint32_t mask) {
+	primask = mask;
+	while(!primask && pending) {
+		int irq_level = (pending & (1 << LEVEL_I2C)) ? LEVEL_I2C : LEVEL_UART;
+		pending &= ~(1 << irq_level);
+		run_interrupt(irq_level);
+	}
+} // __set_PRIMASK()
+
+/**
+ * @brief Mask interrupts. A simulated interrupt may arrive meanwhile.
+ *
+ * @return none
+ */
+void __disable_irq(void) {
+	primask = 1;
+	preempt_point();
+} // __disable_irq()
+
+/**
+ * @brief Let a simulated interrupt of a higher priority than the running
+ *        context arrive. It runs right away, or once PRIMASK is cleared.
+ *
+ * @return none
+ */
+static void preempt_point() {
+	int irq_level;
+
+	if(random_next() % 4 != 0) return;
+	irq_level = (random_next() & 1) ? LEVEL_I2C : LEVEL_UART;
+	if(irq_level >= level) return;
+	if(primask) {
+		pending |= 1 << irq_level;
+		deferred++;
+		return;
+	}
+	run_interrupt(irq_level);
+} // preempt_point()
+
+/**
+ * @brief Write the message with the next id into buf
+ *
+ * @param buf - Where to write the message, at least LINE_LENGTH bytes
+ * @param id  - Set to the id of the message
+ *
+ * @return Length of the message
+ */
+static size_t make_message(char *buf, uint32_t *id) {
+	uint32_t length;
+
+	*id = next_id++;
+	assert(*id < MAX_MESSAGES);
+	length = 1 + *id % MAX_PAYLOAD;
+	sprintf(buf, "<%08lx:", (unsigned long)*id);
+	memset(buf + 10, 'a' + *id % 26, length);
+	buf[10 + length] = '>';
+
+	return 11 + length;
+} // make_message()
+
+/**
+ * @brief Write a message in place, as uart_printf() does. The message is
+ *        written one character at a time, so interrupts can arrive in the
+ *        middle of it. If it doesn't fit in the claimed space, it is
+ *        enqueued whole instead.
+ *
+ * @return none
+ */
+static void produce_in_place() {
+	char message[LINE_LENGTH];
+	char *space;
+	uint32_t start, id;
+	size_t claimed, used = 0, length;
+
+	claimed = cbfifo_claim(&queue, LINE_LENGTH, &start, (void**)&space);
+	preempt_point();
+	length = make_message(message, &id);
+	if(length <= claimed) {
+		for(size_t i = 0; i < length; i++) {
+			space[i] = message[i];
+			preempt_point();
+		}
+		used = length;
+	}
+	if(claimed > 0) {
+		if(!cbfifo_trim(&queue, start, claimed, used)) {
+			memset(space + used, PAD, claimed - used);
+		}
+		preempt_point();
+		cbfifo_publish(&queue);
+	}
+	if(used > 0) {
+		sent++;
+		return;
+	}
+	// Too little contiguous space, enqueue the message whole instead
+	if(cbfifo_enqueue_mp(&queue, message, length) == length) sent++; else dropped++;
+} // produce_in_place()
+
+/**
+ * @brief Write a message with cbfifo_enqueue_mp(), as __sys_write() does
+ *
+ * @return none
+ */
+static void produce_copy() {
+	char message[LINE_LENGTH];
+	uint32_t id;
+	size_t length = make_message(message, &id);
+
+	preempt_point();
+	if(cbfifo_enqueue_mp(&queue, message, length) == length) sent++; else dropped++;
+} // produce_copy()
+
+/**
+ * @brief Parse the whole messages out of the consumer output. Each one
+ *        must be intact, and must not have been received before.
+ *
+ * @return none
+ */
+static void parse_output() {
+	size_t i = 0, end;
+	unsigned long id;
+	uint32_t length;
+
+	while(i < output_length) {
+		// A message needs its id, and its end to be received
+		end = i;
+		while(end < output_length && output[end] != '>') end++;
+		if(end == output_length) break;
+		assert(output[i] == '<');
+		assert(sscanf(&output[i + 1], "%08lx:", &id) == 1);
+		assert(id < next_id && !seen[id]);
+		seen[id] = 1;
+		length = 1 + id % MAX_PAYLOAD;
+		assert(end - i == 10 + length);
+		for(size_t j = i + 10; j < end; j++) {
+			assert(output[j] == (char)('a' + id % 26));
+		}
+		received++;
+		i = end + 1;
+	}
+	memmove(output, &output[i], output_length - i);
+	output_length -= i;
+} // parse_output()
+
+/**
+ * @brief Drain part of the queue, as the UART interrupt does, skipping the
+ *        padding of claims that couldn't be trimmed
+ *
+ * @param max - Most characters to drain
+ *
+ * @return none
+ */
+static void consume(size_t max) {
+	char *next;
+	size_t count;
+
+	while(max > 0 && (count = cbfifo_peek(&queue, max, (void**)&next)) > 0) {
+		for(size_t i = 0; i < count; i++) {
+			if(next[i] != PAD) {
+				assert(output_length < sizeof(output));
+				output[output_length++] = next[i];
+			}
+		}
+		cbfifo_release(&queue, count);
+		max -= count;
+	}
+	parse_output();
+} // consume()
+
+static void run_interrupt(int irq_level) {
+	int saved_level = level;
+	uint32_t saved_primask = primask;
+
+	// Interrupts are taken with PRIMASK clear and return with it restored
+	assert(!primask);
+	level = irq_level;
+	preemptions++;
+	if(irq_level == LEVEL_UART && (random_next() & 1)) {
+		consume(random_next() % 64);
+	}
+	else if(random_next() & 1) {
+		produce_in_place();
+	}
+	else {
+		produce_copy();
+	}
+	assert(primask == 0);
+	primask = saved_primask;
+	level = saved_level;
+} // run_interrupt()
+
+int main() {
+	// Nothing preempts the unit test, it has FIFOs of its own
+	level = 0;
+	cbfifo_test();
+	level = LEVEL_MAIN;
+
+	// Start near the top of the index range, so it wraps around 2^32
+	cbfifo_init(&queue);
+	queue.head = queue.tail = queue.claim = 0xFFFFF000u;
+	for(uint32_t i = 0; i < ITERATIONS; i++) {
+		if(random_next() & 1) produce_in_place(); else produce_copy();
+		// Every claim is published once the main loop is back on top
+		assert(queue.writers == 0);
+		assert(queue.claim == queue.head);
+		if(random_next() & 1) consume(random_next() % 128);
+	}
+	// Drain what is left, producers that arrive meanwhile add to it
+	while(!cbfifo_empty(&queue)) consume(QUEUE_LENGTH);
+	assert(output_length == 0);
+	assert(received == sent);
+	assert(sent + dropped == next_id);
+
+	printf("cbfifo host test: %lu messages received whole, %lu dropped while full, %lu nested interrupts, %lu held off by PRIMASK\n",
+			(unsigned long)received, (unsigned long)dropped, (unsigned long)preemptions, (unsigned long)deferred);
+	return 0;
+} // main()
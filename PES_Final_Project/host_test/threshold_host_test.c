@@ -0,0 +1,170 @@
+/**
+ * @file threshold_host_test.c
+ * @brief Host test of the squared magnitude threshold compare
+ *
+ * This c file checks on the host that comparing the
+ * squared magnitude of a sample against
+ * acceleration_threshold_sq() decides the same as taking
+ * the square root in double and comparing in m/s^2. It
+ * also runs the traces through the square root path the
+ * detector used before, which truncated each axis to 4
+ * counts and took 4 counts as 1 mg, and checks that it
+ * only disagrees close to the target.
+ *
+ * Build and run from PES_Final_Project:
+ * gcc -DDEBUG -Ihost_test -Isource host_test/threshold_host_test.c source/detector.c -lm -o threshold_host_test && ./threshold_host_test
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include "timers.h"
+#include "accelerometer.h"
+#include "detector.h"
+
+
+#define TARGET_STEP      (0.05f)  // Step between the targets tested in m/s^2
+#define TARGET_COUNT     (1560)   // Targets tested, up to 78 m/s^2, just under 8g
+#define ANGLES           (64)     // Directions of the samples around each target
+#define RADIUS_STEPS     (25)     // Radii of the samples around each target
+#define RADIUS_STEP      (0.25)   // Step between the radii in counts, from -3 to +3
+#define WALK_SAMPLES     (1000000) // Samples in the random walk trace
+#define WALK_TARGETS     (16)     // Targets the random walk trace is tested against
+#define OLD_SCALE        (4096.0 / 4000.0) // Overestimate of the old path, which took 4 counts as 1 mg
+#define OLD_TRUNCATION   (0.014)  // Most the old path loses in m/s^2 truncating both axes to 4 counts
+
+static uint32_t random_state = 12345; // Pseudo-random sequence, fixed so runs repeat
+static uint32_t samples = 0;          // Samples compared
+static uint32_t old_disagreements = 0; // Samples the old path decides differently
+static double   old_low = 0;          // Lowest acceleration minus target of a disagreement in m/s^2
+static double   old_high = 0;         // Highest acceleration minus target of a disagreement in m/s^2
+
+
+/**
+ * @brief Get TIMER_Ticks() for detector_benchmark(), which isn't run
+ *
+ * @return 0
+ */
+uint32_t TIMER_Ticks() {
+	return 0;
+} // TIMER_Ticks()
+
+/**
+ * @brief Get the next pseudo-random number
+ *
+ * @return Pseudo-random number from 0 to 32767
+ */
+static uint32_t random_next() {
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) & 0x7FFF;
+} // random_next()
+
+/**
+ * @brief Calculate the linear acceleration of a sample with a square
+ *        root in double, without truncating it
+ *
+ * @param x - X axis in 14 bit counts
+ * @param y - Y axis in 14 bit counts
+ *
+ * @return linear acceleration in units of m/s^2
+ */
+static double exact_acceleration(int16_t x, int16_t y) {
+	return sqrt((double)x * x + (double)y * y) * ACCEL_STANDARD_GRAVITY / ACCEL_COUNTS_PER_G;
+} // exact_acceleration()
+
+/**
+ * @brief Calculate the linear acceleration of a sample as the detector
+ *        did before the squared magnitude compare
+ *
+ * @param x - X axis in 14 bit counts
+ * @param y - Y axis in 14 bit counts
+ *
+ * @return linear acceleration in units of m/s^2
+ */
+static float old_acceleration(int16_t x, int16_t y) {
+	int16_t acc_x = x / 4;
+	int16_t acc_y = y / 4;
+	float linear_acc = sqrt((acc_x * acc_x) + (acc_y * acc_y));
+
+	return (linear_acc * 9.80665) / 1000;
+} // old_acceleration()
+
+/**
+ * @brief Decide one sample both ways against a target. The squared
+ *        magnitude compare must agree with the exact square root, and
+ *        the old path may only disagree close to the target.
+ *
+ * @param x            - X axis in 14 bit counts
+ * @param y            - Y axis in 14 bit counts
+ * @param target       - Target acceleration in m/s^2
+ * @param threshold_sq - acceleration_threshold_sq(target)
+ *
+ * @return none
+ */
+static void check_sample(int16_t x, int16_t y, float target, uint32_t threshold_sq) {
+	uint32_t magnitude_sq = (uint32_t)(x * x) + (uint32_t)(y * y);
+	double acceleration = exact_acceleration(x, y);
+	bool reached = magnitude_sq >= threshold_sq;
+
+	samples++;
+	if(reached != (acceleration >= target)) {
+		printf("target %f: %d, %d is %.9f m/s^2, compare says %d\n", target, x, y, acceleration, reached);
+		assert(false);
+	}
+	if(reached != (old_acceleration(x, y) >= target)) {
+		old_disagreements++;
+		if(acceleration - target < old_low) old_low = acceleration - target;
+		if(acceleration - target > old_high) old_high = acceleration - target;
+		assert(acceleration >= target / OLD_SCALE - 1e-6);
+		assert(acceleration < target + OLD_TRUNCATION);
+	}
+} // check_sample()
+
+int main() {
+	detector_test();
+
+	// Samples in every direction hugging each target
+	for(int t = 1; t <= TARGET_COUNT; t++) {
+		float target = t * TARGET_STEP;
+		uint32_t threshold_sq = acceleration_threshold_sq(target);
+		double radius = target / ACCEL_STANDARD_GRAVITY * ACCEL_COUNTS_PER_G;
+
+		// The threshold is the first squared magnitude at the target
+		assert(sqrt((double)threshold_sq) * ACCEL_STANDARD_GRAVITY / ACCEL_COUNTS_PER_G >= target);
+		assert(sqrt((double)threshold_sq - 1) * ACCEL_STANDARD_GRAVITY / ACCEL_COUNTS_PER_G < target);
+		assert(fabsf(acceleration_mps2(threshold_sq) - target) < 1e-3f * target);
+		for(int a = 0; a < ANGLES; a++) {
+			for(int r = 0; r < RADIUS_STEPS; r++) {
+				double length = radius + (r - RADIUS_STEPS / 2) * RADIUS_STEP;
+				double angle = a * 2 * M_PI / ANGLES;
+				check_sample((int16_t)lround(length * cos(angle)), (int16_t)lround(length * sin(angle)), target, threshold_sq);
+			}
+		}
+	}
+
+	// A random walk over the whole 8g range, against a few targets
+	for(int t = 0; t < WALK_TARGETS; t++) {
+		float target = 0.5f + t * 4.8f;
+		uint32_t threshold_sq = acceleration_threshold_sq(target);
+		int32_t x = 0, y = 0;
+
+		for(int i = 0; i < WALK_SAMPLES; i++) {
+			x += (int32_t)(random_next() % 257) - 128;
+			y += (int32_t)(random_next() % 257) - 128;
+			if(x > 23000 || x < -23000) x /= 2;
+			if(y > 23000 || y < -23000) y /= 2;
+			check_sample(x, y, target, threshold_sq);
+		}
+	}
+
+	printf("threshold host test: %lu samples, compare matches the exact square root on all of them; "
+			"old path disagrees on %lu, from %.4f to %.4f m/s^2 off the target\n",
+			(unsigned long)samples, (unsigned long)old_disagreements, old_low, old_high);
+	return 0;
+} // main()
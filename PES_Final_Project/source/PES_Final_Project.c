@@ -42,13 +42,27 @@
 #include "cmd_processor.h"
 #include "i2c.h"
 #include "accelerometer.h"
+#include "filter.h"
+#include "spectrum.h"
+#include "stats.h"
+#include "detector.h"
+#include "power.h"
 
 
-uint8_t target_r_val        = 0;     // RGB LED r value to set when detected acceleration reaches target
-uint8_t target_g_val        = 255;   // RGB LED g value to set when detected acceleration reaches target
-uint8_t target_b_val        = 0;     // RGB LED b value to set when detected acceleration reaches target
-float   target_acceleration = 10;    // Target acceleration value in m/s^2
-bool    print_acceleration  = false; // True means print acceleration values, False means don't print acceleration values
+#define TRANSIENT_HOLD_MS   (250) // Time the LED stays lit after a transient event in hardware mode
+
+uint8_t  target_r_val        = 0;     // RGB LED r value to set when detected acceleration reaches target
+uint8_t  target_g_val        = 255;   // RGB LED g value to set when detected acceleration reaches target
+uint8_t  target_b_val        = 0;     // RGB LED b value to set when detected acceleration reaches target
+float    target_acceleration = 10;    // Target acceleration value in m/s^2
+uint32_t target_threshold_sq = 0;     // Target acceleration as a squared magnitude in counts^2
+float    hysteresis_band     = 0.5;   // Acceleration below the target in m/s^2 at which the LED turns off
+uint32_t min_on_time         = 100;   // Minimum time in ms the LED stays on
+uint32_t min_off_time        = 50;    // Minimum time in ms the LED stays off
+detector_t led_detector;              // Decides whether the target acceleration has been reached
+bool     print_acceleration  = false; // True means print acceleration values, False means don't print acceleration values
+uint32_t print_interval      = 1000;  // Interval between printed acceleration statistics in ms
+stats_t  print_stats;                 // Acceleration statistics of the current print interval
 
 
 int main(void) {
@@ -60,12 +74,30 @@ int main(void) {
   uart0_init();
   i2c_init();
   accelerometer_init();
+  power_init();
+  target_threshold_sq = acceleration_threshold_sq(target_acceleration);
+  accelerometer_set_transient_threshold(target_acceleration);
 
 #if DEBUG
   // Test circular buffer API
   cbfifo_test();
+  // Test detector state machine
+  detector_test();
+  // Test filter kernels
+  filter_test();
+  // Test low power mode selection
+  power_test();
+  // Measure circular buffer throughput
+  cbfifo_benchmark();
+  // Measure the CPU cost of a FIFO burst read
+  accelerometer_benchmark();
+  // Measure the detector compare against the square root it replaced
+  detector_benchmark();
 #endif
 
+  detector_init(&led_detector);
+  detector_configure(&led_detector, target_acceleration, hysteresis_band, min_on_time, min_off_time);
+
   // Print application introduction message
   printf("\n\r");
   printf("------------------------------------------------\n\r");
@@ -76,37 +108,123 @@ int main(void) {
   printf("If you reach the target acceleration, then the RGB LED will change colors!\n\r");
   printf("Be sure to keep the board flat, and not rotated, otherwise the acceleration due to\n\r");
   printf("gravity will negatively affect the acceleration measurements.\n\r");
+  printf("Use gravity or hpf mode to remove gravity from all three axes if the board will be tilted.\n\r");
+  printf("Use hardware mode to let the accelerometer detect the target while the MCU sleeps.\n\r");
+  printf("Use lowpower to stop the MCU while the board is still. The first key press only wakes it.\n\r");
   printf("COMMAND INFO\n\r");
   printf("Command to set target color         : color <r> <g> <b>\n\r");
   printf("Command to set target acceleration  : acceleration <target acceleration>\n\r");
-  printf("Command to print acceleration values: print\n\r");
+  printf("Command to set LED hysteresis       : hysteresis <band> [min on ms] [min off ms]\n\r");
+  printf("Command to print acceleration values: print [interval in ms]\n\r");
+  printf("Command to set acceleration mode    : mode <planar|gravity|hpf [cutoff]|hardware>\n\r");
+  printf("Command to set sample resolution    : resolution <14|8>\n\r");
+  printf("Command to set full-scale range     : range <2|4|8|auto>\n\r");
+  printf("Command to set output data rate     : odr <800|adaptive> [floor]\n\r");
+  printf("Command to set sample filter        : filter <off|biquad <shift> <b0 b1 b2 a1 a2>...|fir <b0>...>\n\r");
+  printf("Command to print vibration spectrum : fft <128|256|512> [x|y|z]\n\r");
+  printf("Command to print I2C statistics     : i2c\n\r");
+  printf("Command to calibrate sensor offsets : calibrate [samples]\n\r");
+  printf("Command to set low power mode       : lowpower <on|off> [idle s]\n\r");
+  printf("Command to print idle time          : idle\n\r");
   printf("DEFAULT VALUES\n\r");
   printf("Default target color r=%d, g=%d, b=%d\n\r", target_r_val, target_g_val, target_b_val);
   printf("Default target acceleration = %f m/s^2\n\r", target_acceleration);
+  printf("Default hysteresis = %f m/s^2, min on = %lu ms, min off = %lu ms\n\r",
+		  hysteresis_band, (unsigned long)min_on_time, (unsigned long)min_off_time);
   printf("------------------------------------------------\n\r");
   printf("\n\r");
   printf("> ");
 
-  double acceleration = 0.0;
+  accel_sample_t samples[FILTER_BLOCK_SIZE];
+  uint32_t num_samples;
+  uint16_t odr;
+  uint32_t step;
+  bool led_on = false;
+  uint32_t magnitude_sq = 0;
+  bool above;
+  uint32_t transient_events = 0, last_transient_events = 0;
+  ticktime_t transient_time = 0;
+  stats_reset(&print_stats);
   TIMER_Reset();
   // Infinite loop
   while (1) {
 
     // Blocking receive
 	while(cbfifo_empty(&uart_rx_cbfifo)) {
-		// Read acceleration values and convert from mg to m/s^2
-		acceleration = (read_linear_acceleration() * 9.80665) / 1000;
-		// Print acceleration value in 1s intervals if printing is enabled
-		if(TIMER_Get() >= 1000 && print_acceleration) {
-			printf("acceleration = %f m/s^2\n\r", acceleration);
-			TIMER_Reset();
+		// Time out a stuck I2C transfer, so a misbehaving sensor cannot stall the loop
+		i2c_poll();
+		// Undo a failed range or ODR switch, which leaves the sensor stopped
+		accelerometer_poll();
+		// In hardware mode the accelerometer transient engine does the detection
+		if(accelerometer_get_mode() == ACCEL_MODE_TRANSIENT) {
+			// Wait for an interrupt: SysTick, UART0, or a transient event on INT1.
+			// Stop the MCU instead while the accelerometer is asleep.
+			power_idle(print_acceleration || led_on);
+			transient_events = accelerometer_get_transient_events();
+			if(transient_events != last_transient_events) {
+				last_transient_events = transient_events;
+				transient_time = TIMER_Now();
+				if(!led_on) {
+					RGB_LED_SetColor(target_r_val, target_g_val, target_b_val);
+					led_on = true;
+				}
+			}
+			else if(led_on && (TIMER_Now() - transient_time) >= TRANSIENT_HOLD_MS) {
+				RGB_LED_SetColor(255, 255, 255);
+				led_on = false;
+			}
+			// Print event count each interval if printing is enabled
+			if(TIMER_Get() >= print_interval && print_acceleration) {
+				uart_printf("transient events = %lu\n\r", (unsigned long)transient_events);
+				TIMER_Reset();
+			}
+			continue;
 		}
-		// Update RGB LED color based on acceleration measurement
-		if(acceleration >= target_acceleration) {
-			RGB_LED_SetColor(target_r_val, target_g_val, target_b_val);
+
+		// Wait for the accelerometer interrupt to queue a block of samples,
+		// in WAIT, or in VLPS if the accelerometer is asleep and nothing else
+		// needs the MCU
+		if(cbfifo_empty(&accel_cbfifo)) {
+			power_idle(print_acceleration || spectrum_active() || led_detector.on);
+			continue;
+		}
+		// Filter and run every queued sample through the detector
+		while(!cbfifo_empty(&accel_cbfifo)) {
+			num_samples = cbfifo_dequeue(&accel_cbfifo, samples, FILTER_BLOCK_SIZE);
+			// Let the filter, spectrum, detector, and statistics follow the adaptive ODR
+			odr = accelerometer_get_odr();
+			step = ACCEL_ODR_HZ / odr;
+			filter_set_odr(odr);
+			spectrum_set_odr(odr);
+			detector_set_odr(&led_detector, odr);
+			filter_block(samples, num_samples);
+			spectrum_add_samples(samples, num_samples);
+			for(uint32_t i = 0; i < num_samples; i++) {
+				magnitude_sq = acceleration_magnitude_sq(&samples[i]);
+				above = (magnitude_sq >= target_threshold_sq);
+				detector_update(&led_detector, magnitude_sq);
+				if(print_acceleration) {
+					stats_update(&print_stats, magnitude_sq, above, step);
+				}
+			}
+		}
+		// Transform and print a completed spectrum block
+		spectrum_process();
+		// Print acceleration statistics each interval if printing is enabled
+		if(TIMER_Get() >= print_interval && print_acceleration) {
+			stats_print(&print_stats);
+			stats_reset(&print_stats);
+			TIMER_Reset();
 		}
-		else {
-			RGB_LED_SetColor(255, 255, 255);
+		// Update RGB LED color only when the detector changes state
+		if(led_detector.on != led_on) {
+			if(led_detector.on) {
+				RGB_LED_SetColor(target_r_val, target_g_val, target_b_val);
+			}
+			else {
+				RGB_LED_SetColor(255, 255, 255);
+			}
+			led_on = led_detector.on;
 		}
 	}
 
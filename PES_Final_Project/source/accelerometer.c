@@ -11,49 +11,1236 @@
  * @references The Dean Textbook
  *
  */
-#include <math.h>
+#include <stdlib.h>
+#include "MKL25Z4.h"
 #include "i2c.h"
+#include "timers.h"
+#include "nvstore.h"
 #include "accelerometer.h"
 
 
-#define MMA_ADDR  0x3A // I2C address for MMA8451Q accelerometer
-#define REG_CTRL1 0x2A // CTRL1 register address for MMA8451Q
-#define REG_XHI   0x01 // X_OUT_MSB register address for MMA8451Q
+#define MMA_ADDR           0x3A // I2C address for MMA8451Q accelerometer
+#define REG_F_STATUS       0x00 // F_STATUS register address for MMA8451Q (STATUS when FIFO is disabled)
+#define REG_XHI            0x01 // X_OUT_MSB register address for MMA8451Q
+#define REG_F_SETUP        0x09 // F_SETUP register address for MMA8451Q
+#define REG_SYSMOD         0x0B // SYSMOD register address for MMA8451Q
+#define REG_XYZ_DATA_CFG   0x0E // XYZ_DATA_CFG register address for MMA8451Q
+#define REG_HP_CUTOFF      0x0F // HP_FILTER_CUTOFF register address for MMA8451Q
+#define REG_TRANSIENT_CFG  0x1D // TRANSIENT_CFG register address for MMA8451Q
+#define REG_TRANSIENT_SRC  0x1E // TRANSIENT_SRC register address for MMA8451Q
+#define REG_TRANSIENT_THS  0x1F // TRANSIENT_THS register address for MMA8451Q
+#define REG_TRANSIENT_CNT  0x20 // TRANSIENT_COUNT register address for MMA8451Q
+#define REG_ASLP_COUNT     0x29 // ASLP_COUNT register address for MMA8451Q
+#define REG_CTRL1          0x2A // CTRL1 register address for MMA8451Q
+#define REG_CTRL2          0x2B // CTRL2 register address for MMA8451Q
+#define REG_CTRL3          0x2C // CTRL3 register address for MMA8451Q
+#define REG_CTRL4          0x2D // CTRL4 register address for MMA8451Q
+#define REG_CTRL5          0x2E // CTRL5 register address for MMA8451Q
+#define REG_OFF_X          0x2F // OFF_X register address for MMA8451Q
+#define REG_OFF_Y          0x30 // OFF_Y register address for MMA8451Q
+#define REG_OFF_Z          0x31 // OFF_Z register address for MMA8451Q, the last writable register
 
+#define SHADOW_FIRST       REG_F_SETUP                    // First register held in the shadow
+#define SHADOW_SIZE        (REG_OFF_Z - SHADOW_FIRST + 1) // Registers held in the shadow
+#define SHADOW_BIT(reg)    ((uint64_t)1 << ((reg) - SHADOW_FIRST))
+
+#define F_SETUP_CIRCULAR   0x40 // F_MODE = 01: FIFO keeps the newest 32 samples
+#define F_SETUP_WMRK_MASK  0x3F // FIFO watermark
+#define F_STATUS_WMRK_FLAG 0x40 // FIFO sample count is at or above the watermark
+#define F_STATUS_CNT_MASK  0x3F // Number of samples currently held in the FIFO
+#define CTRL_INT_FIFO      0x40 // FIFO interrupt bit in CTRL4 (enable) and CTRL5 (route to INT1)
+#define CTRL_INT_TRANS     0x20 // Transient interrupt bit in CTRL4 (enable) and CTRL5 (route to INT1)
+#define CTRL_INT_ASLP      0x80 // Auto-sleep/wake interrupt bit in CTRL4 (enable) and CTRL5 (route to INT1, left clear for INT2)
+#define CTRL1_ASLP_MASK    0xC0 // ODR while asleep
+#define CTRL1_ASLP_50HZ    0x00 // ODR of ACCEL_ODR_LOW_HZ (50Hz) while asleep
+#define CTRL2_SLPE         0x04 // Auto-sleep enable
+#define CTRL3_WAKE_TRANS   0x40 // Transient events wake the MMA8451Q from sleep
+#define SYSMOD_MASK        0x03 // System mode
+#define SYSMOD_SLEEP       0x02 // Asleep at the ASLP_RATE ODR
+#define CTRL1_STANDBY      0x00 // Standby mode, required for configuration writes
+#define CTRL1_ACTIVE       0x01 // Active mode, 14 bit samples, and 800Hz ODR
+#define CTRL1_F_READ       0x02 // Fast-read mode, 8 bit samples (MSB only)
+#define CTRL1_DR_MASK      0x38 // ODR, 800Hz when clear
+#define CTRL1_DR_LOW       0x20 // ODR of ACCEL_ODR_LOW_HZ (50Hz)
+#define XYZ_CFG_HPF_OUT    0x10 // Output and FIFO data are high-pass filtered
+#define XYZ_CFG_FS_MASK    0x03 // Full-scale range, 2g, 4g or 8g
+#define TRANSIENT_CFG_XYZ  0x1E // Latch events, flag X/Y/Z high-pass filtered transients
+#define TRANSIENT_CFG_WAKE 0x0E // Flag X/Y/Z high-pass filtered transients without latching, for wake up only
+#define TRANSIENT_THS_WAKE 0x02 // Motion that wakes the MMA8451Q from sleep, 0.126g
+#define TRANSIENT_SRC_EA   0x40 // One or more transient event flags are set
+#define TRANSIENT_THS_DBCM 0x80 // Clear the debounce counter when below threshold
+#define TRANSIENT_THS_MAX  0x7F // Largest TRANSIENT_THS threshold
+#define TRANSIENT_LSB      (258) // TRANSIENT_THS resolution (0.063g) in 14 bit counts
+#define TRANSIENT_DEBOUNCE (2)   // Samples over threshold before an event (2.5ms at 800Hz)
+#define BYTES_PER_SAMPLE   6    // X, Y and Z MSB/LSB pairs
+#define BYTES_PER_SAMPLE_8 3    // X, Y and Z MSB only in fast-read mode
+
+#define GRAVITY_SHIFT      (8)        // Gravity low-pass averages over 2^8 samples (0.32 s at 800Hz)
+#define ODR_LOW_SHIFT      (4)        // log2(ACCEL_ODR_HZ / ACCEL_ODR_LOW_HZ)
+
+#define RANGE_UP_COUNTS    (7168) // Sample size in 14 bit counts that steps the range up, 7/8 of full scale
+#define RANGE_DOWN_COUNTS  (3072) // Block peak in 14 bit counts under which the range may step down, 3/4 of the next lower full scale
+#define RANGE_DOWN_BLOCKS  (40)   // Consecutive quiet blocks before the range steps down (0.8 s at 16 samples per block)
+#define SWITCH_STEPS       (5)    // Register writes in a range or ODR switch
+
+#define ODR_DOWN_BLOCKS    (25)   // Consecutive quiet blocks before the ODR drops (0.5 s at 16 samples per block)
+#define SLOPE_FACTOR       (2)    // Sample to sample change, in standard deviations of the floor, that restores the full ODR
+
+#define OFFSET_MG_PER_LSB  (2)    // OFF_X/Y/Z resolution in mg
+#define CALIBRATE_GAP_MS   (2000) // Longest wait for the next block of samples while calibrating, longer than a block at 50Hz
+
+#define ASLP_COUNT_MS      (320) // ASLP_COUNT resolution at 800Hz ODR
+#define ASLP_COUNT_MAX     (255) // Largest ASLP_COUNT
+
+#define INT1_PIN           (14) // MMA8451Q INT1 is wired to PTA14 on the FRDM-KL25Z
+#define INT2_PIN           (15) // MMA8451Q INT2 is wired to PTA15 on the FRDM-KL25Z
+
+#define ACCEL_QUEUE_LENGTH (64)  // Sample queue capacity, two full MMA8451Q FIFO blocks
+
+CBFIFO_DEFINE(accel_cbfifo, accel_sample_t, ACCEL_QUEUE_LENGTH);
+
+static accel_mode_t       accel_mode    = ACCEL_MODE_PLANAR; // Linear acceleration calculation mode
+static accel_hpf_cutoff_t hpf_cutoff    = ACCEL_HPF_16HZ;    // High-pass filter cutoff used in hpf mode
+static int32_t            gravity[3];                         // Gravity estimate per axis in counts scaled by 2^gravity_shift
+static uint8_t            gravity_shift = GRAVITY_SHIFT;      // Gravity low-pass length, shortened at the low ODR to keep its time constant
+static bool               gravity_valid = false;              // False until the estimate is seeded with a sample
+static uint8_t            transient_ths = TRANSIENT_THS_MAX;  // TRANSIENT_THS threshold used in hardware mode
+static volatile uint32_t  transient_events = 0;               // Transient events signaled on INT1
+static accel_resolution_t resolution    = ACCEL_RESOLUTION_14BIT; // Acquisition resolution
+static volatile uint32_t  sample_count  = 0;                  // Samples read from the FIFO
+static accel_range_t      range         = ACCEL_RANGE_2G;     // Full-scale range of the samples being read
+static bool               auto_range    = false;              // True to step the range with the sample size
+static uint8_t            quiet_blocks  = 0;                  // Consecutive blocks small enough for the next lower range
+static accel_range_t      next_range;                         // Range being switched to
+static bool               adaptive_odr  = false;              // True to drop the ODR while the signal is quiet
+static volatile uint16_t  odr           = ACCEL_ODR_HZ;       // ODR of the samples being read in Hz
+static uint16_t           next_odr;                           // ODR being switched to in Hz
+static uint32_t           variance_floor = 0;                 // Block variance in counts^2 under which the signal is quiet
+static uint32_t           slope_floor   = 0;                  // Sample to sample change in counts under which the signal is quiet
+static uint8_t            quiet_odr_blocks = 0;               // Consecutive quiet blocks at the full ODR
+static int32_t            last_sample[3];                     // Previous sample for the sample to sample change
+static uint16_t           gravity_odr   = ACCEL_ODR_HZ;       // ODR the gravity estimate is scaled for
+static uint8_t            switch_step;                        // Register write of the switch in progress
+static uint8_t            switch_regs[SWITCH_STEPS];          // Registers written by the switch
+static uint8_t            switch_data[SWITCH_STEPS];          // Values written by the switch
+static volatile bool      switch_failed = false;              // True if a switch ended on a failed write, until the MMA8451Q is restored
+static bool               auto_sleep    = false;              // True if the MMA8451Q drops to a slow ODR when idle
+static volatile bool      asleep        = false;              // True while the MMA8451Q is in sleep mode
+static uint8_t            sysmod;                             // SYSMOD read for each sleep/wake transition
+
+static uint8_t fifo_data[ACCEL_FIFO_DEPTH * BYTES_PER_SAMPLE]; // Raw FIFO burst
+static uint8_t fifo_count;    // Number of samples in the FIFO burst
+static uint8_t f_status;      // F_STATUS read at the start of each FIFO drain
+static uint8_t transient_src; // TRANSIENT_SRC read for each transient event
+
+static uint8_t  shadow[SHADOW_SIZE]; // Register values from F_SETUP to OFF_Z as they should be on the MMA8451Q
+static uint64_t dirty = 0;           // Bit per shadow register not yet written to the MMA8451Q
+static uint8_t  ctrl1_device;        // CTRL1 value last written to the MMA8451Q
+
+
+/**
+ * @brief Set a register in the shadow. The MMA8451Q is only written
+ *        once reg_flush() is called, and only if the value changed.
+ *
+ * @param reg  - Register address from F_SETUP to OFF_Z
+ * @param data - Byte of data to write
+ *
+ * @return none
+ */
+static void reg_write(uint8_t reg, uint8_t data) {
+	if(shadow[reg - SHADOW_FIRST] != data) {
+		shadow[reg - SHADOW_FIRST] = data;
+		dirty |= SHADOW_BIT(reg);
+	}
+} // reg_write()
+
+/**
+ * @brief Get a register value from the shadow
+ *
+ * @param reg - Register address from F_SETUP to OFF_Z
+ *
+ * @return Register value
+ */
+static uint8_t reg_read(uint8_t reg) {
+	return shadow[reg - SHADOW_FIRST];
+} // reg_read()
+
+/**
+ * @brief Write the dirty run of registers starting at reg in one
+ *        auto-incrementing burst. The run stays dirty if the write fails,
+ *        so it is written again by the next reg_flush().
+ *
+ * @param reg - First dirty register of the run
+ * @param end - Set to the register after the end of the run
+ *
+ * @return I2C_OK for success, otherwise the error that ended the write
+ */
+static i2c_status_t flush_run(uint8_t reg, uint8_t *end) {
+	uint8_t next = reg;
+	uint32_t run = 0;
+	i2c_status_t status;
+
+	while(next <= REG_OFF_Z && (dirty & SHADOW_BIT(next))) {
+		run |= SHADOW_BIT(next);
+		next++;
+	}
+	*end = next;
+	status = i2c_write_bytes(MMA_ADDR, reg, &shadow[reg - SHADOW_FIRST], next - reg);
+	if(status == I2C_OK) {
+		dirty &= ~run;
+	}
+
+	return status;
+} // flush_run()
+
+/**
+ * @brief Re-arm the INT1 pin interrupt once its event has been serviced.
+ *        The pin interrupt is level sensitive, so it fires again right
+ *        away if INT1 is still asserted.
+ *
+ * @return none
+ */
+static void int1_rearm() {
+	PORTA->PCR[INT1_PIN] = (PORTA->PCR[INT1_PIN] & ~PORT_PCR_IRQC_MASK) | PORT_PCR_ISF_MASK | PORT_PCR_IRQC(8);
+} // int1_rearm()
+
+/**
+ * @brief Re-arm the INT2 pin interrupt once its event has been serviced
+ *
+ * @return none
+ */
+static void int2_rearm() {
+	PORTA->PCR[INT2_PIN] = (PORTA->PCR[INT2_PIN] & ~PORT_PCR_IRQC_MASK) | PORT_PCR_ISF_MASK | PORT_PCR_IRQC(8);
+} // int2_rearm()
+
+/**
+ * @brief Get the ODR the MMA8451Q is sampling at. While asleep it samples
+ *        at ACCEL_ODR_LOW_HZ, whatever the ODR it wakes up to.
+ *
+ * @return ODR in Hz, ACCEL_ODR_HZ or ACCEL_ODR_LOW_HZ
+ */
+static uint16_t sample_odr() {
+	return asleep ? ACCEL_ODR_LOW_HZ : odr;
+} // sample_odr()
 
 /**
- * @brief Initialize the MMA8451Q accelerometer
+ * @brief Keep the INT1 handler off the bus, and let a FIFO read or range
+ *        switch that is already under way finish, so the shadow and the
+ *        sample format can be changed. reg_flush() or reg_flush_format()
+ *        releases the lock.
+ *
+ * @return none
+ */
+static void config_lock() {
+	NVIC_DisableIRQ(PORTA_IRQn);
+	while(i2c_busy()) {
+		i2c_poll();
+	}
+} // config_lock()
+
+/**
+ * @brief Write the dirty shadow registers to the MMA8451Q. Registers
+ *        other than CTRL1, and the CTRL1 bits other than ACTIVE, can
+ *        only be changed in standby, so CTRL1 is first written with
+ *        ACTIVE cleared, together with the dirty registers that follow
+ *        it (CTRL2 to OFF_Z). The remaining dirty runs are written next,
+ *        and CTRL1 is written last to return to active mode. The flush
+ *        stops at the first failed write, and every register not written
+ *        stays dirty. After a failed range or ODR switch the registers it
+ *        writes are written back too, and INT1 is re-armed once they all
+ *        are. The range of the samples follows XYZ_DATA_CFG as it is
+ *        written. Must be called under config_lock(), which it keeps.
+ *
+ * @return I2C_OK for success, otherwise the error that ended the flush
+ */
+static i2c_status_t reg_flush_locked() {
+	i2c_status_t status = I2C_OK;
+	uint8_t ctrl1, reg, end;
+	bool standby;
+
+	// Write back every register a failed switch may have changed
+	if(switch_failed) {
+		dirty |= SHADOW_BIT(REG_CTRL1) | SHADOW_BIT(REG_XYZ_DATA_CFG) | SHADOW_BIT(REG_F_SETUP);
+	}
+	ctrl1 = reg_read(REG_CTRL1);
+	standby = (dirty & ~SHADOW_BIT(REG_CTRL1)) || ((ctrl1 ^ ctrl1_device) & ~CTRL1_ACTIVE);
+
+	if(standby) {
+		// Standby, and the registers from CTRL2 on, in one burst
+		shadow[REG_CTRL1 - SHADOW_FIRST] = ctrl1 & ~CTRL1_ACTIVE;
+		dirty |= SHADOW_BIT(REG_CTRL1);
+		status = flush_run(REG_CTRL1, &end);
+		if(status == I2C_OK) {
+			ctrl1_device = ctrl1 & ~CTRL1_ACTIVE;
+			// Going active again starts the MMA8451Q awake
+			asleep = false;
+		}
+		// Every other dirty run, lowest address first
+		for(reg = SHADOW_FIRST; reg <= REG_OFF_Z && status == I2C_OK; reg++) {
+			if(dirty & SHADOW_BIT(reg)) {
+				status = flush_run(reg, &end);
+				reg = end;
+			}
+		}
+		shadow[REG_CTRL1 - SHADOW_FIRST] = ctrl1;
+		if((ctrl1 & CTRL1_ACTIVE) || status != I2C_OK) {
+			dirty |= SHADOW_BIT(REG_CTRL1);
+		}
+	}
+	// CTRL1 last, so the new configuration takes effect as it goes active
+	if(status == I2C_OK && (dirty & SHADOW_BIT(REG_CTRL1))) {
+		status = flush_run(REG_CTRL1, &end);
+	}
+	// Samples are in the range on the MMA8451Q, which is the shadow's once
+	// XYZ_DATA_CFG is written, and the last one written otherwise
+	if(!(dirty & SHADOW_BIT(REG_XYZ_DATA_CFG))) {
+		range = (accel_range_t)(reg_read(REG_XYZ_DATA_CFG) & XYZ_CFG_FS_MASK);
+	}
+	if(status == I2C_OK) {
+		ctrl1_device = ctrl1;
+		// Samples can be read again once a failed switch is undone
+		if(switch_failed) {
+			switch_failed = false;
+			int1_rearm();
+		}
+	}
+
+	return status;
+} // reg_flush_locked()
+
+/**
+ * @brief Write the dirty shadow registers to the MMA8451Q with
+ *        reg_flush_locked(). The INT1 handler is kept off the bus
+ *        meanwhile, and until the end of any config_lock() before.
+ *
+ * @return I2C_OK for success, otherwise the error that ended the flush
+ */
+static i2c_status_t reg_flush() {
+	i2c_status_t status;
+
+	// A range or ODR switch writes the CTRL1 and F_SETUP shadows when it
+	// completes, so read them only once no switch can be under way
+	config_lock();
+	status = reg_flush_locked();
+	NVIC_EnableIRQ(PORTA_IRQn);
+
+	return status;
+} // reg_flush()
+
+/**
+ * @brief Write the dirty shadow registers to the MMA8451Q for a change
+ *        of the sample format. The FIFO is disabled meanwhile, which
+ *        empties it, so no samples are left in the old format. The FIFO
+ *        is enabled again even if the first flush fails. Both flushes
+ *        are under one config_lock(), so the INT1 handler can't run
+ *        until the FIFO is enabled again.
+ *
+ * @return I2C_OK for success, otherwise the first error of the flushes
+ */
+static i2c_status_t reg_flush_format() {
+	uint8_t f_setup;
+	i2c_status_t status, enable_status;
+
+	config_lock();
+	f_setup = reg_read(REG_F_SETUP);
+	reg_write(REG_F_SETUP, 0);
+	status = reg_flush_locked();
+	reg_write(REG_F_SETUP, f_setup);
+	enable_status = reg_flush_locked();
+	NVIC_EnableIRQ(PORTA_IRQn);
+
+	return (status != I2C_OK) ? status : enable_status;
+} // reg_flush_format()
+
+/**
+ * @brief Set the transient engine and the interrupt registers in the
+ *        shadow for the current mode and auto-sleep setting. INT1 signals
+ *        either transient events or the FIFO watermark, and INT2 signals
+ *        sleep/wake transitions. The transient engine wakes the MMA8451Q
+ *        from sleep, in the FIFO modes with a low fixed threshold.
+ *
+ * @return none
+ */
+static void write_event_config() {
+	bool transient = (accel_mode == ACCEL_MODE_TRANSIENT);
+	uint8_t int_aslp = auto_sleep ? CTRL_INT_ASLP : 0;
+
+	if(transient) {
+		reg_write(REG_TRANSIENT_THS, TRANSIENT_THS_DBCM | transient_ths);
+		reg_write(REG_TRANSIENT_CNT, TRANSIENT_DEBOUNCE);
+		reg_write(REG_TRANSIENT_CFG, TRANSIENT_CFG_XYZ);
+	}
+	else if(auto_sleep) {
+		reg_write(REG_TRANSIENT_THS, TRANSIENT_THS_DBCM | TRANSIENT_THS_WAKE);
+		reg_write(REG_TRANSIENT_CNT, TRANSIENT_DEBOUNCE);
+		reg_write(REG_TRANSIENT_CFG, TRANSIENT_CFG_WAKE);
+	}
+	else {
+		reg_write(REG_TRANSIENT_CFG, 0);
+	}
+	reg_write(REG_CTRL3, auto_sleep ? CTRL3_WAKE_TRANS : 0);
+	reg_write(REG_CTRL4, int_aslp | (transient ? CTRL_INT_TRANS : CTRL_INT_FIFO));
+	reg_write(REG_CTRL5, transient ? CTRL_INT_TRANS : CTRL_INT_FIFO);
+} // write_event_config()
+
+/**
+ * @brief Initialize the MMA8451Q accelerometer. Samples are acquired
+ *        by the INT1 pin interrupt and queued in accel_cbfifo.
  *
  * @return none
  */
 void accelerometer_init() {
+	nvstore_t record;
+
+	// Start the shadow from the configuration the MMA8451Q currently
+	// holds, which may be left over from before an MCU reset
+	i2c_read_bytes(MMA_ADDR, SHADOW_FIRST, shadow, SHADOW_SIZE);
+	dirty = 0;
+	ctrl1_device = reg_read(REG_CTRL1);
+
+	// Correct the zero-g offsets with the calibration saved in flash, if any
+	if(nvstore_load(&record)) {
+		reg_write(REG_OFF_X, record.offsets[0]);
+		reg_write(REG_OFF_Y, record.offsets[1]);
+		reg_write(REG_OFF_Z, record.offsets[2]);
+	}
+	// Enable circular FIFO with watermark
+	reg_write(REG_F_SETUP, F_SETUP_CIRCULAR | ACCEL_FIFO_WATERMARK);
+	// Enable the FIFO watermark interrupt and route it to INT1 (active low, push-pull),
+	// with auto-sleep off
+	write_event_config();
+	reg_write(REG_CTRL2, reg_read(REG_CTRL2) & ~CTRL2_SLPE);
 	// Set active mode, 14 bit samples, and 800Hz ODR
-	i2c_write_byte(MMA_ADDR, REG_CTRL1, 0x01);
+	reg_write(REG_CTRL1, CTRL1_ACTIVE);
+	// FIFO can only be configured while in standby, so write all registers
+	// from standby even if the MMA8451Q is already configured this way
+	dirty |= SHADOW_BIT(REG_F_SETUP) | SHADOW_BIT(REG_CTRL1);
+	reg_flush();
+
+	// Initialize the sample queue
+	cbfifo_init(&accel_cbfifo);
+	// Set INT1 pin to GPIO with an interrupt while the line is held low
+	SIM->SCGC5 |= SIM_SCGC5_PORTA_MASK;
+	PORTA->PCR[INT1_PIN] = PORT_PCR_ISF_MASK | PORT_PCR_MUX(1) | PORT_PCR_IRQC(8);
+	PORTA->PCR[INT2_PIN] = PORT_PCR_ISF_MASK | PORT_PCR_MUX(1) | PORT_PCR_IRQC(8);
+	// Enable interrupts
+	NVIC_SetPriority(PORTA_IRQn, 3);
+	NVIC_ClearPendingIRQ(PORTA_IRQn);
+	NVIC_EnableIRQ(PORTA_IRQn);
 } // accelerometer_init()
 
 /**
- * @brief Read linear acceleration from the MMA8451Q
+ * @brief Transfer callback for each register write of a range or ODR
+ *        switch. Queues the next write, and completes the switch after
+ *        the last. A failed write ends the switch, with the range and
+ *        ODR unchanged and INT1 left off, and accelerometer_poll()
+ *        restores the MMA8451Q from the shadow.
+ *
+ * @param status  - Status of the transfer
+ * @param context - Unused
+ *
+ * @return none
+ */
+static void switch_write_done(i2c_status_t status, void *context) {
+	i2c_transfer_t transfer = {
+		.dev = MMA_ADDR, .read = false, .data_count = 1, .callback = switch_write_done
+	};
+
+	if(status != I2C_OK) {
+		// The MMA8451Q may be left in standby or with part of the new
+		// configuration, so no samples are read until it is restored
+		switch_failed = true;
+		return;
+	}
+	if(++switch_step < SWITCH_STEPS) {
+		transfer.reg = switch_regs[switch_step];
+		transfer.data = &switch_data[switch_step];
+		if(!i2c_submit(&transfer)) {
+			switch_failed = true;
+		}
+		return;
+	}
+	// Samples read from now on are in the new range and at the new ODR
+	shadow[REG_XYZ_DATA_CFG - SHADOW_FIRST] = switch_data[1];
+	shadow[REG_F_SETUP - SHADOW_FIRST] = switch_data[3];
+	shadow[REG_CTRL1 - SHADOW_FIRST] = switch_data[4];
+	ctrl1_device = switch_data[4];
+	range = next_range;
+	odr = next_odr;
+	int1_rearm();
+} // switch_write_done()
+
+/**
+ * @brief Choose the full-scale range for the next block. The range steps
+ *        up as soon as a sample gets close to full scale, and down once
+ *        the samples have fit the next lower range with margin for
+ *        RANGE_DOWN_BLOCKS blocks.
+ *
+ * @param peak - Largest axis value of the block in 14 bit counts
+ *
+ * @return Full-scale range to switch to, or the current range
+ */
+static accel_range_t select_range(int16_t peak) {
+	if(peak >= RANGE_UP_COUNTS) {
+		quiet_blocks = 0;
+		if(range < ACCEL_RANGE_8G) return range + 1;
+	}
+	else if(peak < RANGE_DOWN_COUNTS && range > ACCEL_RANGE_2G) {
+		if(++quiet_blocks >= RANGE_DOWN_BLOCKS) {
+			quiet_blocks = 0;
+			return range - 1;
+		}
+	}
+	else {
+		quiet_blocks = 0;
+	}
+	return range;
+} // select_range()
+
+/**
+ * @brief Choose the ODR for the next block. The full ODR is selected as
+ *        soon as the variance of a block or the change between two
+ *        samples rises above the floor, and the low ODR once the signal
+ *        has stayed below it for ODR_DOWN_BLOCKS blocks. At the low ODR
+ *        each sample is a block, so a rise is caught within one sample.
+ *
+ * @param variance - Sum of the axis variances of the block in counts^2
+ * @param slope    - Largest axis change between two samples in counts
+ *
+ * @return ODR to switch to in Hz, or the current ODR
+ */
+static uint16_t select_odr(uint32_t variance, uint32_t slope) {
+	if(variance >= variance_floor || slope >= slope_floor) {
+		quiet_odr_blocks = 0;
+		return ACCEL_ODR_HZ;
+	}
+	if(odr == ACCEL_ODR_HZ && ++quiet_odr_blocks >= ODR_DOWN_BLOCKS) {
+		quiet_odr_blocks = 0;
+		return ACCEL_ODR_LOW_HZ;
+	}
+	return odr;
+} // select_odr()
+
+/**
+ * @brief Switch the full-scale range and the ODR. The switch is made
+ *        right after a FIFO burst, while the FIFO is nearly empty:
+ *        standby with the new ODR, the new XYZ_DATA_CFG range, the FIFO
+ *        disabled and enabled again with the watermark for the new ODR
+ *        to drop the few samples in the old format, and active again.
+ *        The writes are queued one after the other.
+ *
+ * @param new_range - Full-scale range to switch to
+ * @param new_odr   - ODR to switch to in Hz
+ *
+ * @return True if a switch was started, false otherwise
+ */
+static bool start_switch(accel_range_t new_range, uint16_t new_odr) {
+	uint8_t ctrl1 = reg_read(REG_CTRL1) & ~CTRL1_DR_MASK;
+	uint8_t f_setup = reg_read(REG_F_SETUP) & ~F_SETUP_WMRK_MASK;
+	i2c_transfer_t transfer = {
+		.dev = MMA_ADDR, .read = false, .data_count = 1, .callback = switch_write_done
+	};
+
+	if(new_range == range && new_odr == odr) return false;
+
+	// At the low ODR every sample is drained as it arrives
+	if(new_odr == ACCEL_ODR_LOW_HZ) {
+		ctrl1 |= CTRL1_DR_LOW;
+		f_setup |= 1;
+	}
+	else {
+		f_setup |= ACCEL_FIFO_WATERMARK;
+	}
+	next_range = new_range;
+	next_odr = new_odr;
+	switch_regs[0] = REG_CTRL1;
+	switch_data[0] = ctrl1 & ~CTRL1_ACTIVE;
+	switch_regs[1] = REG_XYZ_DATA_CFG;
+	switch_data[1] = (reg_read(REG_XYZ_DATA_CFG) & ~XYZ_CFG_FS_MASK) | new_range;
+	switch_regs[2] = REG_F_SETUP;
+	switch_data[2] = 0;
+	switch_regs[3] = REG_F_SETUP;
+	switch_data[3] = f_setup;
+	switch_regs[4] = REG_CTRL1;
+	switch_data[4] = ctrl1;
+	switch_step = 0;
+	transfer.reg = switch_regs[0];
+	transfer.data = &switch_data[0];
+
+	return i2c_submit(&transfer);
+} // start_switch()
+
+/**
+ * @brief Transfer callback for the FIFO burst. Aligns and scales the
+ *        samples and hands them to the main context through accel_cbfifo.
+ *        In auto-range and adaptive ODR modes the range and the ODR are
+ *        then switched if needed.
+ *
+ * @param status  - Status of the transfer
+ * @param context - Unused
+ *
+ * @return none
+ */
+static void fifo_read_done(i2c_status_t status, void *context) {
+	accel_sample_t sample;
+	uint8_t *data = fifo_data;
+	int16_t x, y, z;
+	int16_t peak = 0;
+	int32_t sum[3] = { 0 };
+	uint64_t sum_sq[3] = { 0 };
+	uint32_t slope = 0, variance = 0;
+	int32_t axis[3];
+	uint32_t now = TIMER_Ticks();
+	uint32_t period = TIMER_TICKS_PER_MS * 1000 / sample_odr();
+
+	// Drop a failed burst, the FIFO is read again on the next interrupt
+	if(status != I2C_OK) fifo_count = 0;
+	sample_count += fifo_count;
+
+	for(uint8_t i = 0; i < fifo_count; i++) {
+		if(resolution == ACCEL_RESOLUTION_8BIT) {
+			// Scale the MSB to 14 bits
+			x = (int16_t)(data[0] << 8) >> 2;
+			y = (int16_t)(data[1] << 8) >> 2;
+			z = (int16_t)(data[2] << 8) >> 2;
+			data += BYTES_PER_SAMPLE_8;
+		}
+		else {
+			// Align for 14 bits
+			x = (int16_t)((data[0] << 8) | data[1]) >> 2;
+			y = (int16_t)((data[2] << 8) | data[3]) >> 2;
+			z = (int16_t)((data[4] << 8) | data[5]) >> 2;
+			data += BYTES_PER_SAMPLE;
+		}
+		// Largest axis value for auto-ranging
+		if(abs(x) > peak) peak = abs(x);
+		if(abs(y) > peak) peak = abs(y);
+		if(abs(z) > peak) peak = abs(z);
+		// Scale to the 4096 counts/g of the 2g range, 8g still fits in 16 bits
+		sample.x = x * (1 << range);
+		sample.y = y * (1 << range);
+		sample.z = z * (1 << range);
+		// Block variance and sample to sample change for the adaptive ODR
+		if(adaptive_odr) {
+			axis[0] = sample.x;
+			axis[1] = sample.y;
+			axis[2] = sample.z;
+			for(int a = 0; a < 3; a++) {
+				sum[a] += axis[a];
+				sum_sq[a] += (uint32_t)(axis[a] * axis[a]);
+				if((uint32_t)abs(axis[a] - last_sample[a]) > slope) slope = abs(axis[a] - last_sample[a]);
+				last_sample[a] = axis[a];
+			}
+		}
+		// The newest sample was taken about when the burst was read
+		sample.time = now - (uint32_t)(fifo_count - 1 - i) * period;
+		if(!cbfifo_full(&accel_cbfifo)) {
+			cbfifo_enqueue(&accel_cbfifo, &sample, 1);
+		}
+		else {
+			// error - queue full.
+			// discard sample
+		}
+	}
+	if(fifo_count > 0) {
+		if(adaptive_odr) {
+			for(int a = 0; a < 3; a++) {
+				variance += (uint32_t)((sum_sq[a] - ((uint64_t)((int64_t)sum[a] * sum[a]) / fifo_count)) / fifo_count);
+			}
+		}
+		// INT1 is re-armed once a switch has completed
+		if(start_switch(auto_range ? select_range(peak) : range,
+		                adaptive_odr ? select_odr(variance, slope) : odr)) return;
+	}
+	int1_rearm();
+} // fifo_read_done()
+
+/**
+ * @brief Transfer callback for F_STATUS. Once the FIFO has reached the
+ *        watermark, all pending samples are read in a single burst; with
+ *        the FIFO enabled the register address wraps from OUT_Z_LSB (or
+ *        OUT_Z_MSB in fast-read mode) back to OUT_X_MSB so consecutive
+ *        samples are returned back to back.
+ *
+ * @param status  - Status of the transfer
+ * @param context - Unused
+ *
+ * @return none
+ */
+static void f_status_read_done(i2c_status_t status, void *context) {
+	i2c_transfer_t transfer = {
+		.dev = MMA_ADDR, .reg = REG_XHI, .read = true, .data = fifo_data, .callback = fifo_read_done
+	};
+
+	if(status == I2C_OK && (f_status & F_STATUS_WMRK_FLAG)) {
+		fifo_count = f_status & F_STATUS_CNT_MASK;
+		transfer.data_count = fifo_count *
+				((resolution == ACCEL_RESOLUTION_8BIT) ? BYTES_PER_SAMPLE_8 : BYTES_PER_SAMPLE);
+		if(i2c_submit(&transfer)) return;
+	}
+	int1_rearm();
+} // f_status_read_done()
+
+/**
+ * @brief Transfer callback for TRANSIENT_SRC. Reading it clears the
+ *        latched event, which is counted.
+ *
+ * @param status  - Status of the transfer
+ * @param context - Unused
+ *
+ * @return none
+ */
+static void transient_src_read_done(i2c_status_t status, void *context) {
+	if(status == I2C_OK && (transient_src & TRANSIENT_SRC_EA)) {
+		transient_events++;
+	}
+	int1_rearm();
+} // transient_src_read_done()
+
+/**
+ * @brief Transfer callback for SYSMOD. Reading it clears the sleep/wake
+ *        interrupt.
+ *
+ * @param status  - Status of the transfer
+ * @param context - Unused
+ *
+ * @return none
+ */
+static void sysmod_read_done(i2c_status_t status, void *context) {
+	if(status == I2C_OK) {
+		asleep = ((sysmod & SYSMOD_MASK) == SYSMOD_SLEEP);
+	}
+	int2_rearm();
+} // sysmod_read_done()
+
+/**
+ * @brief PORTA interrupt handler. Starts reading the MMA8451Q FIFO when
+ *        INT1 signals that the watermark was reached; the samples are
+ *        queued by the transfer callbacks without waiting on the bus.
+ *        In hardware mode INT1 signals transient events instead, which
+ *        are counted. INT2 signals that the MMA8451Q went to sleep or
+ *        woke up. Each pin interrupt stays off until its event has been
+ *        serviced and the pin deasserts.
+ *
+ * @return none
+ */
+void PORTA_IRQHandler(void) {
+	i2c_transfer_t transfer = { .dev = MMA_ADDR, .read = true, .data_count = 1 };
+
+	if(PORTA->ISFR & (1 << INT2_PIN)) {
+		// Turn off the pin interrupt and clear its flag, then read SYSMOD
+		PORTA->PCR[INT2_PIN] = (PORTA->PCR[INT2_PIN] & ~PORT_PCR_IRQC_MASK) | PORT_PCR_ISF_MASK;
+		transfer.reg = REG_SYSMOD;
+		transfer.data = &sysmod;
+		transfer.callback = sysmod_read_done;
+		if(!i2c_submit(&transfer)) {
+			int2_rearm();
+		}
+	}
+
+	if(!(PORTA->ISFR & (1 << INT1_PIN))) return;
+
+	// Turn off the pin interrupt and clear its flag
+	PORTA->PCR[INT1_PIN] = (PORTA->PCR[INT1_PIN] & ~PORT_PCR_IRQC_MASK) | PORT_PCR_ISF_MASK;
+
+	if(accel_mode == ACCEL_MODE_TRANSIENT) {
+		transfer.reg = REG_TRANSIENT_SRC;
+		transfer.data = &transient_src;
+		transfer.callback = transient_src_read_done;
+	}
+	else {
+		transfer.reg = REG_F_STATUS;
+		transfer.data = &f_status;
+		transfer.callback = f_status_read_done;
+	}
+	// If the I2C queue is full, try again on the next interrupt
+	if(!i2c_submit(&transfer)) {
+		int1_rearm();
+	}
+} // PORTA_IRQHandler()
+
+/**
+ * @brief Restore the MMA8451Q from the shadow after a range or ODR switch
+ *        ended on a failed write. The FIFO is emptied meanwhile, so no
+ *        samples are left in the format the switch left behind. A failed
+ *        restore is tried again on the next call.
  *
- * @return linear acceleration in units of mg
+ * @return I2C_OK if no restore was needed or it succeeded, otherwise the
+ *         error that ended the restore
  */
-float read_linear_acceleration() {
-	uint8_t data[4];
-	int16_t acc_x_raw = 0, acc_y_raw = 0;
-	int16_t acc_x = 0, acc_y = 0;
-	float linear_acc;
+i2c_status_t accelerometer_poll() {
+	if(!switch_failed) return I2C_OK;
+
+	return reg_flush_format();
+} // accelerometer_poll()
+
+/**
+ * @brief Stop sample acquisition: keep the INT1 and INT2 handlers off the
+ *        bus, and let a transfer that is already under way finish, so
+ *        no I2C or DMA interrupt is needed until accelerometer_resume()
+ *
+ * @return none
+ */
+void accelerometer_pause() {
+	config_lock();
+} // accelerometer_pause()
+
+/**
+ * @brief Restart sample acquisition after accelerometer_pause(). The
+ *        MMA8451Q FIFO is emptied first: it holds 40 ms of samples at
+ *        800 Hz, and a flash write can take 120 ms, after which it only
+ *        has the newest samples, with a gap of unknown length before
+ *        them. Acquisition restarts with new samples instead, and the
+ *        samples of the pause are lost.
+ *
+ * @return I2C_OK for success, otherwise the first error of the flushes
+ */
+i2c_status_t accelerometer_resume() {
+	return reg_flush_format();
+} // accelerometer_resume()
+
+/**
+ * @brief Measure the CPU cycles of a full FIFO burst read with byte
+ *        interrupts and with DMA, with sample acquisition paused
+ *
+ * @return none
+ */
+void accelerometer_benchmark() {
+	config_lock();
+	i2c_benchmark(MMA_ADDR, REG_XHI, fifo_data, sizeof(fifo_data));
+	NVIC_EnableIRQ(PORTA_IRQn);
+} // accelerometer_benchmark()
+
+/**
+ * @brief Select how linear acceleration is calculated from each sample
+ *
+ * @param mode - Linear acceleration calculation mode
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_mode(accel_mode_t mode) {
+	i2c_status_t status;
+
+	config_lock();
+	// Only hpf mode filters the output data, the transient engine has its own filter
+	reg_write(REG_XYZ_DATA_CFG, (reg_read(REG_XYZ_DATA_CFG) & XYZ_CFG_FS_MASK) |
+			((mode == ACCEL_MODE_HPF) ? XYZ_CFG_HPF_OUT : 0));
+	accel_mode = mode;
+	write_event_config();
+	status = reg_flush();
+
+	// Start a new gravity estimate from the next sample
+	gravity_valid = false;
+
+	return status;
+} // accelerometer_set_mode()
+
+/**
+ * @brief Get the current linear acceleration calculation mode
+ *
+ * @return Linear acceleration calculation mode
+ */
+accel_mode_t accelerometer_get_mode() {
+	return accel_mode;
+} // accelerometer_get_mode()
+
+/**
+ * @brief Set the cutoff frequency of the MMA8451Q high-pass filter used
+ *        in hpf mode
+ *
+ * @param cutoff - High-pass filter cutoff
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_hpf_cutoff(accel_hpf_cutoff_t cutoff) {
+	config_lock();
+	reg_write(REG_HP_CUTOFF, cutoff);
+	hpf_cutoff = cutoff;
+	return reg_flush();
+} // accelerometer_set_hpf_cutoff()
+
+/**
+ * @brief Get the cutoff frequency of the MMA8451Q high-pass filter
+ *
+ * @return High-pass filter cutoff
+ */
+accel_hpf_cutoff_t accelerometer_get_hpf_cutoff() {
+	return hpf_cutoff;
+} // accelerometer_get_hpf_cutoff()
+
+/**
+ * @brief Set the acceleration the transient engine detects in hardware
+ *        mode. The acceleration is translated into TRANSIENT_THS counts
+ *        of 0.063g, rounded to the nearest count; an event is flagged
+ *        after TRANSIENT_DEBOUNCE consecutive samples above it.
+ *
+ * @param acceleration - Acceleration in m/s^2
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_transient_threshold(float acceleration) {
+	float counts = (acceleration / ACCEL_STANDARD_GRAVITY) * ACCEL_COUNTS_PER_G;
+	float ths = (counts + (TRANSIENT_LSB / 2)) / TRANSIENT_LSB;
+
+	transient_ths = (ths >= TRANSIENT_THS_MAX) ? TRANSIENT_THS_MAX : (uint8_t)ths;
+	if(accel_mode == ACCEL_MODE_TRANSIENT) {
+		config_lock();
+		reg_write(REG_TRANSIENT_THS, TRANSIENT_THS_DBCM | transient_ths);
+		return reg_flush();
+	}
+
+	return I2C_OK;
+} // accelerometer_set_transient_threshold()
+
+/**
+ * @brief Get the number of transient events signaled since boot
+ *
+ * @return Number of transient events
+ */
+uint32_t accelerometer_get_transient_events() {
+	return transient_events;
+} // accelerometer_get_transient_events()
+
+/**
+ * @brief Update the running gravity estimate of one axis with a
+ *        first order low-pass filter and remove it from the sample
+ *
+ * @param estimate - Gravity estimate of the axis, scaled by 2^gravity_shift
+ * @param value    - Sample value of the axis in counts
+ *
+ * @return Axis acceleration with gravity removed in counts
+ */
+static int32_t remove_gravity(int32_t *estimate, int32_t value) {
+	*estimate += value - (*estimate >> gravity_shift);
+	return value - (*estimate >> gravity_shift);
+} // remove_gravity()
+
+/**
+ * @brief Clamp an axis value to the 16 bit sample range
+ *
+ * @param value - Axis value in counts
+ *
+ * @return Axis value limited to INT16_MIN to INT16_MAX
+ */
+static int32_t clamp_axis(int32_t value) {
+	if(value > INT16_MAX) return INT16_MAX;
+	if(value < INT16_MIN) return INT16_MIN;
+	return value;
+} // clamp_axis()
+
+/**
+ * @brief Calculate the squared linear acceleration of a sample. In planar
+ *        mode this is based on the x-axis and y-axis accelerations, in
+ *        gravity mode on all three axes after removing the gravity
+ *        estimate, and in hpf mode on all three axes as filtered by the
+ *        sensor. Must be called once per sample, in order, since the
+ *        gravity estimate is updated with every call.
+ *
+ * @param sample - Sample to calculate the linear acceleration of
+ *
+ * @return squared linear acceleration in units of counts^2
+ */
+uint32_t acceleration_magnitude_sq(const accel_sample_t *sample) {
+	int32_t acc_x = sample->x;
+	int32_t acc_y = sample->y;
+	int32_t acc_z = 0;
+
+	if(accel_mode == ACCEL_MODE_HPF) {
+		// Gravity was already removed by the sensor
+		acc_z = sample->z;
+	}
+	else if(accel_mode == ACCEL_MODE_GRAVITY) {
+		// Keep the time constant of the estimate when the ODR changes
+		if(gravity_odr != sample_odr()) {
+			gravity_odr = sample_odr();
+			for(int a = 0; a < 3; a++) {
+				gravity[a] = (gravity_odr == ACCEL_ODR_HZ) ? gravity[a] * (1 << ODR_LOW_SHIFT) : gravity[a] / (1 << ODR_LOW_SHIFT);
+			}
+			gravity_shift = (gravity_odr == ACCEL_ODR_HZ) ? GRAVITY_SHIFT : GRAVITY_SHIFT - ODR_LOW_SHIFT;
+		}
+		// Seed the estimate so it does not have to settle from zero
+		if(!gravity_valid) {
+			gravity[0] = acc_x * (1 << gravity_shift);
+			gravity[1] = acc_y * (1 << gravity_shift);
+			gravity[2] = sample->z * (1 << gravity_shift);
+			gravity_valid = true;
+		}
+		acc_x = remove_gravity(&gravity[0], acc_x);
+		acc_y = remove_gravity(&gravity[1], acc_y);
+		acc_z = remove_gravity(&gravity[2], sample->z);
+		// Near full scale of the 8g range an axis can exceed 16 bits once
+		// gravity is removed, so clamp it to keep the sum of squares in range
+		acc_x = clamp_axis(acc_x);
+		acc_y = clamp_axis(acc_y);
+		acc_z = clamp_axis(acc_z);
+	}
+
+	return (uint32_t)(acc_x * acc_x) + (uint32_t)(acc_y * acc_y) + (uint32_t)(acc_z * acc_z);
+} // acceleration_magnitude_sq()
+
+/**
+ * @brief Select the acquisition resolution. 8 bit samples are scaled to
+ *        14 bit counts, so thresholds and statistics are unaffected.
+ *
+ * @param res - Acquisition resolution
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_resolution(accel_resolution_t res) {
+	uint8_t ctrl1;
+
+	// Unless a failed write is still pending
+	if(res == resolution && dirty == 0) return I2C_OK;
+
+	// Keep the INT1 handler off the bus until the new resolution is in
+	// place, so no burst is read with the wrong sample size, and no range
+	// or ODR switch changes CTRL1 under the read-modify-write
+	config_lock();
+	ctrl1 = reg_read(REG_CTRL1) & ~CTRL1_F_READ;
+	if(res == ACCEL_RESOLUTION_8BIT) ctrl1 |= CTRL1_F_READ;
+	resolution = res;
+	reg_write(REG_CTRL1, ctrl1);
+	return reg_flush_format();
+} // accelerometer_set_resolution()
+
+/**
+ * @brief Get the acquisition resolution
+ *
+ * @return Acquisition resolution
+ */
+accel_resolution_t accelerometer_get_resolution() {
+	return resolution;
+} // accelerometer_get_resolution()
+
+/**
+ * @brief Get the number of samples read from the MMA8451Q FIFO since boot
+ *
+ * @return Number of samples
+ */
+uint32_t accelerometer_get_sample_count() {
+	return sample_count;
+} // accelerometer_get_sample_count()
+
+/**
+ * @brief Select a fixed full-scale range, which turns auto-ranging off
+ *
+ * @param new_range - Full-scale range
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_range(accel_range_t new_range) {
+	// Keep the INT1 handler off the bus until the new range is in place.
+	// The range of the samples only changes once XYZ_DATA_CFG is written,
+	// by this flush, or by a later one if this one fails.
+	config_lock();
+	auto_range = false;
+	reg_write(REG_XYZ_DATA_CFG, (reg_read(REG_XYZ_DATA_CFG) & ~XYZ_CFG_FS_MASK) | new_range);
+	return reg_flush_format();
+} // accelerometer_set_range()
+
+/**
+ * @brief Turn auto-ranging on or off. Auto-ranging starts from the
+ *        current range.
+ *
+ * @param enable - True to turn auto-ranging on
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_auto_range(bool enable) {
+	config_lock();
+	auto_range = enable;
+	quiet_blocks = 0;
+	return reg_flush();
+} // accelerometer_set_auto_range()
+
+/**
+ * @brief Get the full-scale range of the samples being read
+ *
+ * @return Full-scale range
+ */
+accel_range_t accelerometer_get_range() {
+	return range;
+} // accelerometer_get_range()
+
+/**
+ * @brief Check whether auto-ranging is on
+ *
+ * @return True if auto-ranging is on
+ */
+bool accelerometer_get_auto_range() {
+	return auto_range;
+} // accelerometer_get_auto_range()
+
+/**
+ * @brief Turn MMA8451Q auto-sleep on or off. When on, the MMA8451Q drops
+ *        to ACCEL_ODR_LOW_HZ after idle_ms without motion, and a transient
+ *        event of 0.126g (or the target in hardware mode) wakes it up.
+ *        The sleep ODR is the low ODR of the adaptive ODR, so the samples
+ *        read while asleep need no third rate anywhere they are used.
+ *
+ * @param enable  - True to turn auto-sleep on
+ * @param idle_ms - Time without motion before the MMA8451Q goes to sleep,
+ *                  rounded to 320 ms steps, 320 to 81600 ms
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_auto_sleep(bool enable, uint32_t idle_ms) {
+	uint32_t count = (idle_ms + (ASLP_COUNT_MS / 2)) / ASLP_COUNT_MS;
+
+	if(count < 1) count = 1;
+	if(count > ASLP_COUNT_MAX) count = ASLP_COUNT_MAX;
+
+	config_lock();
+	auto_sleep = enable;
+	reg_write(REG_ASLP_COUNT, count);
+	reg_write(REG_CTRL1, (reg_read(REG_CTRL1) & ~CTRL1_ASLP_MASK) | CTRL1_ASLP_50HZ);
+	reg_write(REG_CTRL2, (reg_read(REG_CTRL2) & ~CTRL2_SLPE) | (enable ? CTRL2_SLPE : 0));
+	write_event_config();
+	return reg_flush();
+} // accelerometer_set_auto_sleep()
+
+/**
+ * @brief Check whether the MMA8451Q is in sleep mode
+ *
+ * @return True if the MMA8451Q is asleep
+ */
+bool accelerometer_asleep() {
+	return asleep;
+} // accelerometer_asleep()
+
+/**
+ * @brief Turn the adaptive ODR on or off. When on, the ODR drops to
+ *        ACCEL_ODR_LOW_HZ once the signal has been quiet for 0.5 s, and
+ *        returns to ACCEL_ODR_HZ within one sample when it rises. The
+ *        signal is quiet while the standard deviation of each block is
+ *        below the floor, and no axis changes by more than twice the
+ *        floor from one sample to the next.
+ *
+ * @param enable    - True to turn the adaptive ODR on
+ * @param std_floor - Standard deviation floor in m/s^2
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_adaptive_odr(bool enable, float std_floor) {
+	float floor_counts = (std_floor * ACCEL_COUNTS_PER_G) / ACCEL_STANDARD_GRAVITY;
+
+	config_lock();
+	adaptive_odr = enable;
+	quiet_odr_blocks = 0;
+	variance_floor = (uint32_t)(floor_counts * floor_counts);
+	slope_floor = (uint32_t)(SLOPE_FACTOR * floor_counts);
+	// Back to the full ODR, dropping the samples at the low ODR
+	if(!enable && odr != ACCEL_ODR_HZ) {
+		odr = ACCEL_ODR_HZ;
+		reg_write(REG_CTRL1, reg_read(REG_CTRL1) & ~CTRL1_DR_MASK);
+		reg_write(REG_F_SETUP, (reg_read(REG_F_SETUP) & ~F_SETUP_WMRK_MASK) | ACCEL_FIFO_WATERMARK);
+		return reg_flush_format();
+	}
+	return reg_flush();
+} // accelerometer_set_adaptive_odr()
+
+/**
+ * @brief Check whether the adaptive ODR is on
+ *
+ * @return True if the adaptive ODR is on
+ */
+bool accelerometer_get_adaptive_odr() {
+	return adaptive_odr;
+} // accelerometer_get_adaptive_odr()
+
+/**
+ * @brief Get the ODR of the samples being read, ACCEL_ODR_LOW_HZ while
+ *        the MMA8451Q is asleep
+ *
+ * @return ODR in Hz, ACCEL_ODR_HZ or ACCEL_ODR_LOW_HZ
+ */
+uint16_t accelerometer_get_odr() {
+	return sample_odr();
+} // accelerometer_get_odr()
+
+/**
+ * @brief Set the MMA8451Q zero-g offset registers. The sensor adds them to
+ *        every sample, so the correction costs no MCU time.
+ *
+ * @param offsets - OFF_X, OFF_Y and OFF_Z in 2mg steps
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_offsets(const int8_t offsets[3]) {
+	config_lock();
+	reg_write(REG_OFF_X, offsets[0]);
+	reg_write(REG_OFF_Y, offsets[1]);
+	reg_write(REG_OFF_Z, offsets[2]);
+	// Let the gravity estimate start over from the corrected samples
+	gravity_valid = false;
+	return reg_flush();
+} // accelerometer_set_offsets()
+
+/**
+ * @brief Get the MMA8451Q zero-g offset registers
+ *
+ * @param offsets - Filled in with OFF_X, OFF_Y and OFF_Z in 2mg steps
+ *
+ * @return none
+ */
+void accelerometer_get_offsets(int8_t offsets[3]) {
+	offsets[0] = (int8_t)reg_read(REG_OFF_X);
+	offsets[1] = (int8_t)reg_read(REG_OFF_Y);
+	offsets[2] = (int8_t)reg_read(REG_OFF_Z);
+} // accelerometer_get_offsets()
+
+/**
+ * @brief Calibrate the zero-g offsets. Averages num_samples samples with
+ *        the board flat and at rest, where it should read 0g on X and Y
+ *        and +1g on Z, and corrects the offset registers by the
+ *        difference. Blocks until the samples have been collected.
+ *        Needs unfiltered samples, so not in hpf or hardware mode.
+ *
+ * @param num_samples - Number of samples to average
+ * @param offsets     - Filled in with the new OFF_X, OFF_Y and OFF_Z in 2mg steps
+ *
+ * @return 0 for success, -1 if the mode is wrong, samples stopped arriving,
+ *         or the offsets could not be written
+ */
+int accelerometer_calibrate(uint32_t num_samples, int8_t offsets[3]) {
+	accel_sample_t sample;
+	int32_t sum[3] = { 0 };
+	int32_t expected[3] = { 0, 0, ACCEL_COUNTS_PER_G };
+	int32_t error, offset;
+	uint32_t count = 0;
+	ticktime_t last_time;
+
+	if(num_samples == 0) return -1;
+	if(accel_mode == ACCEL_MODE_HPF || accel_mode == ACCEL_MODE_TRANSIENT) return -1;
 
-	i2c_read_bytes(MMA_ADDR, REG_XHI, data, sizeof(data));
-	acc_x_raw = (int16_t)((data[0] << 8) | data[1]);
-	acc_y_raw = (int16_t)((data[2] << 8) | data[3]);
+	// Start from fresh samples
+	while(!cbfifo_empty(&accel_cbfifo)) {
+		cbfifo_dequeue(&accel_cbfifo, &sample, 1);
+	}
+	last_time = TIMER_Now();
+	while(count < num_samples) {
+		if(cbfifo_empty(&accel_cbfifo)) {
+			if((TIMER_Now() - last_time) > CALIBRATE_GAP_MS) return -1;
+			i2c_poll();
+			continue;
+		}
+		cbfifo_dequeue(&accel_cbfifo, &sample, 1);
+		sum[0] += sample.x;
+		sum[1] += sample.y;
+		sum[2] += sample.z;
+		count++;
+		last_time = TIMER_Now();
+	}
 
-	// Align for 14 bits
-	acc_x = acc_x_raw >> 2;
-	acc_y = acc_y_raw >> 2;
-	// Range is -2g to 2g so need to divide by 4 in order to get value in mg according to datasheet
-	acc_x /= 4;
-	acc_y /= 4;
-	// Calculate linear acceleration based on x-axis and y-axis accelerations
-	linear_acc = sqrt((acc_x * acc_x) + (acc_y * acc_y));
+	accelerometer_get_offsets(offsets);
+	for(int a = 0; a < 3; a++) {
+		// Error of the mean in counts, converted to 2mg offset steps, rounded
+		error = expected[a] - (sum[a] / (int32_t)count);
+		offset = offsets[a] + (error * 1000 + ((error < 0) ? -1 : 1) * (OFFSET_MG_PER_LSB * ACCEL_COUNTS_PER_G / 2)) /
+		                      (OFFSET_MG_PER_LSB * ACCEL_COUNTS_PER_G);
+		offsets[a] = (offset > INT8_MAX) ? INT8_MAX : (offset < INT8_MIN) ? INT8_MIN : offset;
+	}
+	if(accelerometer_set_offsets(offsets) != I2C_OK) return -1;
 
-	return linear_acc;
-} // read_linear_acceleration()
+	return 0;
+} // accelerometer_calibrate()
@@ -16,19 +16,307 @@
 #define ACCELEROMETER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "cbfifo.h"
+#include "i2c.h"
+
+#define ACCEL_FIFO_DEPTH      32 // Number of samples held by the MMA8451Q FIFO
+#define ACCEL_FIFO_WATERMARK  16 // FIFO fill level at which samples are drained
+#define ACCEL_ODR_HZ          800 // Output data rate in Hz
+#define ACCEL_ODR_LOW_HZ      50  // Output data rate in Hz while the signal is quiet with the adaptive ODR on, or the MMA8451Q is asleep
+#define ACCEL_COUNTS_PER_G    4096     // 14 bit counts per g in the +/-2g range
+#define ACCEL_STANDARD_GRAVITY 9.80665f // m/s^2 per g
+
+// Acceleration sample in 14 bit counts of the 2g range (4096 counts/g),
+// whatever the acquisition resolution and full-scale range
+typedef struct accel_sample_s {
+	int16_t  x;    // X-axis acceleration
+	int16_t  y;    // Y-axis acceleration
+	int16_t  z;    // Z-axis acceleration
+	uint32_t time; // TIMER_Ticks() when the sample was taken
+} accel_sample_t;
+
+// Linear acceleration calculation modes
+typedef enum accel_mode_e {
+	ACCEL_MODE_PLANAR,    // X/Y axes only, board has to stay flat
+	ACCEL_MODE_GRAVITY,   // X/Y/Z axes with a running gravity estimate removed
+	ACCEL_MODE_HPF,       // X/Y/Z axes high-pass filtered by the sensor
+	ACCEL_MODE_TRANSIENT  // Detection done by the sensor transient engine, no samples
+} accel_mode_t;
+
+// MMA8451Q high-pass filter cutoff frequencies at 800Hz ODR (HP_FILTER_CUTOFF SEL)
+typedef enum accel_hpf_cutoff_e {
+	ACCEL_HPF_16HZ = 0,
+	ACCEL_HPF_8HZ  = 1,
+	ACCEL_HPF_4HZ  = 2,
+	ACCEL_HPF_2HZ  = 3
+} accel_hpf_cutoff_t;
+
+// Acquisition resolutions
+typedef enum accel_resolution_e {
+	ACCEL_RESOLUTION_14BIT, // 14 bit samples, 6 bytes per sample on the bus
+	ACCEL_RESOLUTION_8BIT   // 8 bit fast-read samples (F_READ), 3 bytes per sample on the bus
+} accel_resolution_t;
+
+// Full-scale ranges (XYZ_DATA_CFG FS)
+typedef enum accel_range_e {
+	ACCEL_RANGE_2G = 0,
+	ACCEL_RANGE_4G = 1,
+	ACCEL_RANGE_8G = 2
+} accel_range_t;
+
+extern cbfifo_t accel_cbfifo; // Samples acquired by the INT1 interrupt
 
 /**
- * @brief Initialize the MMA8451Q accelerometer
+ * @brief Initialize the MMA8451Q accelerometer. Samples are acquired
+ *        by the INT1 pin interrupt and queued in accel_cbfifo.
  *
  * @return none
  */
 void accelerometer_init();
 
 /**
- * @brief Read linear acceleration from the MMA8451Q
+ * @brief Restore the MMA8451Q from the shadow if a range or ODR switch
+ *        failed. Samples are not read until it has been. Call from the
+ *        main loop.
+ *
+ * @return I2C_OK if no restore was needed or it succeeded, otherwise the
+ *         error that ended the restore
+ */
+i2c_status_t accelerometer_poll();
+
+/**
+ * @brief Stop sample acquisition, and wait for the I2C transfer under way
+ *        to finish, so no I2C or DMA interrupt is needed until
+ *        accelerometer_resume(). Used around flash writes, which need
+ *        interrupts off.
+ *
+ * @return none
+ */
+void accelerometer_pause();
+
+/**
+ * @brief Restart sample acquisition after accelerometer_pause(). The
+ *        MMA8451Q FIFO is emptied first, so the samples of the pause are
+ *        lost rather than read with a gap in them.
+ *
+ * @return I2C_OK for success, otherwise the first error of the flushes
+ */
+i2c_status_t accelerometer_resume();
+
+/**
+ * @brief Measure the CPU cycles of a full FIFO burst read with byte
+ *        interrupts and with DMA, and print them
+ *
+ * @return none
+ */
+void accelerometer_benchmark();
+
+/**
+ * @brief Select how linear acceleration is calculated from each sample
+ *
+ * @param mode - Linear acceleration calculation mode
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_mode(accel_mode_t mode);
+
+/**
+ * @brief Get the current linear acceleration calculation mode
+ *
+ * @return Linear acceleration calculation mode
+ */
+accel_mode_t accelerometer_get_mode();
+
+/**
+ * @brief Set the cutoff frequency of the MMA8451Q high-pass filter used
+ *        in hpf mode
+ *
+ * @param cutoff - High-pass filter cutoff
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_hpf_cutoff(accel_hpf_cutoff_t cutoff);
+
+/**
+ * @brief Get the cutoff frequency of the MMA8451Q high-pass filter
+ *
+ * @return High-pass filter cutoff
+ */
+accel_hpf_cutoff_t accelerometer_get_hpf_cutoff();
+
+/**
+ * @brief Set the acceleration the transient engine detects in hardware
+ *        mode. The acceleration is translated into TRANSIENT_THS counts
+ *        of 0.063g, rounded to the nearest count; an event is flagged
+ *        after TRANSIENT_DEBOUNCE consecutive samples above it.
+ *
+ * @param acceleration - Acceleration in m/s^2
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_transient_threshold(float acceleration);
+
+/**
+ * @brief Get the number of transient events signaled since boot
+ *
+ * @return Number of transient events
+ */
+uint32_t accelerometer_get_transient_events();
+
+/**
+ * @brief Calculate the squared linear acceleration of a sample. In planar
+ *        mode this is based on the x-axis and y-axis accelerations, in
+ *        gravity mode on all three axes after removing the gravity
+ *        estimate, and in hpf mode on all three axes as filtered by the
+ *        sensor. Must be called once per sample, in order, since the
+ *        gravity estimate is updated with every call.
+ *
+ * @param sample - Sample to calculate the linear acceleration of
+ *
+ * @return squared linear acceleration in units of counts^2
+ */
+uint32_t acceleration_magnitude_sq(const accel_sample_t *sample);
+
+/**
+ * @brief Select the acquisition resolution. 8 bit samples are scaled to
+ *        14 bit counts, so thresholds and statistics are unaffected.
+ *
+ * @param resolution - Acquisition resolution
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_resolution(accel_resolution_t resolution);
+
+/**
+ * @brief Get the acquisition resolution
+ *
+ * @return Acquisition resolution
+ */
+accel_resolution_t accelerometer_get_resolution();
+
+/**
+ * @brief Get the number of samples read from the MMA8451Q FIFO since boot
+ *
+ * @return Number of samples
+ */
+uint32_t accelerometer_get_sample_count();
+
+/**
+ * @brief Select a fixed full-scale range, which turns auto-ranging off
+ *
+ * @param new_range - Full-scale range
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_range(accel_range_t new_range);
+
+/**
+ * @brief Turn auto-ranging on or off. Auto-ranging starts from the
+ *        current range.
+ *
+ * @param enable - True to turn auto-ranging on
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_auto_range(bool enable);
+
+/**
+ * @brief Get the full-scale range of the samples being read
+ *
+ * @return Full-scale range
+ */
+accel_range_t accelerometer_get_range();
+
+/**
+ * @brief Check whether auto-ranging is on
+ *
+ * @return True if auto-ranging is on
+ */
+bool accelerometer_get_auto_range();
+
+/**
+ * @brief Turn MMA8451Q auto-sleep on or off. When on, the MMA8451Q drops
+ *        to ACCEL_ODR_LOW_HZ after idle_ms without motion, and a transient
+ *        event of 0.126g (or the target in hardware mode) wakes it up.
+ *
+ * @param enable  - True to turn auto-sleep on
+ * @param idle_ms - Time without motion before the MMA8451Q goes to sleep,
+ *                  rounded to 320 ms steps, 320 to 81600 ms
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_auto_sleep(bool enable, uint32_t idle_ms);
+
+/**
+ * @brief Check whether the MMA8451Q is in sleep mode
+ *
+ * @return True if the MMA8451Q is asleep
+ */
+bool accelerometer_asleep();
+
+/**
+ * @brief Turn the adaptive ODR on or off. When on, the ODR drops to
+ *        ACCEL_ODR_LOW_HZ once the signal has been quiet for 0.5 s, and
+ *        returns to ACCEL_ODR_HZ within one sample when it rises. The
+ *        signal is quiet while the standard deviation of each block is
+ *        below the floor, and no axis changes by more than twice the
+ *        floor from one sample to the next.
+ *
+ * @param enable    - True to turn the adaptive ODR on
+ * @param std_floor - Standard deviation floor in m/s^2
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_adaptive_odr(bool enable, float std_floor);
+
+/**
+ * @brief Check whether the adaptive ODR is on
+ *
+ * @return True if the adaptive ODR is on
+ */
+bool accelerometer_get_adaptive_odr();
+
+/**
+ * @brief Get the ODR of the samples being read, ACCEL_ODR_LOW_HZ while
+ *        the MMA8451Q is asleep
+ *
+ * @return ODR in Hz, ACCEL_ODR_HZ or ACCEL_ODR_LOW_HZ
+ */
+uint16_t accelerometer_get_odr();
+
+/**
+ * @brief Set the MMA8451Q zero-g offset registers. The sensor adds them to
+ *        every sample, so the correction costs no MCU time.
+ *
+ * @param offsets - OFF_X, OFF_Y and OFF_Z in 2mg steps
+ *
+ * @return I2C_OK for success, otherwise the error that ended the register write
+ */
+i2c_status_t accelerometer_set_offsets(const int8_t offsets[3]);
+
+/**
+ * @brief Get the MMA8451Q zero-g offset registers
+ *
+ * @param offsets - Filled in with OFF_X, OFF_Y and OFF_Z in 2mg steps
+ *
+ * @return none
+ */
+void accelerometer_get_offsets(int8_t offsets[3]);
+
+/**
+ * @brief Calibrate the zero-g offsets. Averages num_samples samples with
+ *        the board flat and at rest, where it should read 0g on X and Y
+ *        and +1g on Z, and corrects the offset registers by the
+ *        difference. Blocks until the samples have been collected.
+ *        Needs unfiltered samples, so not in hpf or hardware mode.
+ *
+ * @param num_samples - Number of samples to average
+ * @param offsets     - Filled in with the new OFF_X, OFF_Y and OFF_Z in 2mg steps
  *
- * @return linear acceleration in units of mg
+ * @return 0 for success, -1 if the mode is wrong, samples stopped arriving,
+ *         or the offsets could not be written
  */
-float read_linear_acceleration();
+int accelerometer_calibrate(uint32_t num_samples, int8_t offsets[3]);
 
 #endif /* ACCELEROMETER_H_ */
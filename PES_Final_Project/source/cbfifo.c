@@ -3,21 +3,49 @@
  * @brief Fixed-size FIFO implemented via circular buffer
  *
  * This c file provides functionality for
- * initializing and reading/writing to a circular buffer
+ * initializing and reading/writing to a circular buffer.
+ * Each FIFO has a single producer and a single consumer,
+ * such as an ISR and the main loop, which need no locking.
+ * A FIFO may instead be shared by producers at several interrupt
+ * priorities, which claim space with interrupts briefly masked.
  *
  * @author Maurice Takeda
  * @date November 3, 2022
  * @version 1.0
  *
  */
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include "MKL25Z4.h"
+#include "sysclock.h"
+#include "timers.h"
 #include "cbfifo.h"
 
 
+#define BENCHMARK_BYTES     (16384) // Bytes moved through the FIFO for each transfer size
+#define BENCHMARK_CAPACITY  (256)   // Capacity of the benchmark FIFO in bytes
+
+// Odd sized element to test copies of elements that aren't a word
+typedef struct test_record_s {
+	uint8_t a;
+	uint8_t b;
+	uint8_t c;
+} test_record_t;
+
+// Timestamped sample to test word sized and aligned elements
+typedef struct test_sample_s {
+	int16_t  x;
+	int16_t  y;
+	int16_t  z;
+	uint32_t time;
+} test_sample_t;
+
+
 /**
- * @brief Initialize the data in the circular buffer FIFO
+ * @brief Initialize the data in the circular buffer FIFO, keeping the
+ *        capacity and element size it was defined with. Must not run
+ *        while the producer or consumer may use the FIFO.
  *
  * @param cb - Pointer to circular buffer data structure
  *
@@ -28,98 +56,319 @@ void cbfifo_init(cbfifo_t *cb) {
 	if(!cb) return;
 
 	// Initialize circular buffer
-	memset(cb, 0, sizeof(cb->cbfifo));
-	cb->wptr = 0;
-	cb->rptr = 0;
-	cb->length = 0;
-	cb->full = false;
+	memset(cb->cbfifo, 0, cb->capacity * cb->size);
+	cb->head = 0;
+	cb->tail = 0;
+	cb->claim = 0;
+	cb->writers = 0;
 } // cbfifo_init()
 
 /**
- * @brief Enqueues data onto the FIFO, up to the limit of the available FIFO
- *        capacity.
+ * @brief Enqueues elements onto the FIFO, up to the limit of the available
+ *        FIFO capacity. Only the producer may call this.
  *
  * @param cb    - Pointer to circular buffer data structure
- * @param buf   - Pointer to the data to enqueue
- * @param nbyte - Max number of bytes to enqueue
+ * @param buf   - Pointer to the elements to enqueue
+ * @param count - Max number of elements to enqueue
  *
- * @return The number of bytes actually enqueued, which could be 0. In case
- *         of an error, returns (size_t) -1.
+ * @return The number of elements actually enqueued, which could be 0.
  */
-size_t cbfifo_enqueue(cbfifo_t *cb, void *buf, size_t nbyte) {
-	uint32_t masking_state;
-
+size_t cbfifo_enqueue(cbfifo_t *cb, const void *buf, size_t count) {
     // Check for valid input
 	if(!cb) return 0;
     if(!buf) return 0;
 
-    size_t bytesEnqueued = 0;
-
-    // Attempt to enqueue nbytes
-    for(size_t i = 0; i < nbyte; i++) {
-        // If full return amount of bytes enqueued
-        if(cb->full) return bytesEnqueued;
-        // Place bytes from buf into cbfifo one at a time
-        cb->cbfifo[cb->wptr] = *(char*)(buf + i);
-        // Increment number of bytes written from buf
-        bytesEnqueued++;
-        // Increment number the number of elements currently in the cbfifo
-        masking_state = __get_PRIMASK();
-        __disable_irq();
-        cb->length++;
-        __set_PRIMASK(masking_state);
-        // wptr = (wptr + 1) % capacity
-        cb->wptr = (cb->wptr + 1) & (CAPACITY - 1);
-        // Update full flag
-        cb->full = (cb->wptr == cb->rptr) ? true : false;
-    }
-
-    return bytesEnqueued;
+    // The consumer can only free space, so the space seen here is safe to fill
+    uint32_t head = cb->head;
+    size_t space = cb->capacity - (head - cb->tail);
+    if(count > space) count = space;
+
+    // Copy up to the end of the buffer, then the rest from the start
+    size_t offset = head & (cb->capacity - 1);
+    size_t first = (count < cb->capacity - offset) ? count : cb->capacity - offset;
+    memcpy(&cb->cbfifo[offset * cb->size], buf, first * cb->size);
+    memcpy(cb->cbfifo, (const char*)buf + first * cb->size, (count - first) * cb->size);
+
+    // Make the data visible before the consumer can see the new head
+    __DMB();
+    cb->head = head + count;
+
+    return count;
 } // cbfifo_enqueue()
 
 /**
- * @brief Attempts to remove ("dequeue") up to nbyte bytes of data from the
- *        FIFO. Removed data will be copied into the buffer pointed to by buf.
+ * @brief Attempts to remove ("dequeue") up to count elements from the FIFO.
+ *        Removed elements will be copied into the buffer pointed to by buf.
+ *        Only the consumer may call this.
  *
  * @param cb    - Pointer to circular buffer data structure
- * @param buf   - Destination for the dequeued data
- * @param nbyte - Bytes of data requested
+ * @param buf   - Destination for the dequeued elements
+ * @param count - Elements requested
  *
- * @return The number of bytes actually copied, which will be between 0 and
- *         nbyte.
+ * @return The number of elements actually copied, which will be between 0
+ *         and count.
  */
-size_t cbfifo_dequeue(cbfifo_t *cb, void *buf, size_t nbyte) {
-	uint32_t masking_state;
-
+size_t cbfifo_dequeue(cbfifo_t *cb, void *buf, size_t count) {
     // Check for valid input
 	if(!cb) return 0;
     if(!buf) return 0;
 
-    size_t bytesCopied = 0;
-
-    // Attempt to copy bytes
-    for(size_t i = 0; i < nbyte; i++) {
-        // If empty return amount of bytes copied
-        if((cb->wptr == cb->rptr) && !(cb->full)) return bytesCopied;
-        // Place bytes from cbfifo into buf one at a time
-        *(char*)(buf + i) = cb->cbfifo[cb->rptr];
-        // Increment number of bytes copied to buf
-        bytesCopied++;
-        // Decrement current amount of elements in the cbfifo
-        masking_state = __get_PRIMASK();
-        __disable_irq();
-        cb->length--;
-        __set_PRIMASK(masking_state);
-        // rptr = (rptr + 1) % capacity
-        cb->rptr = (cb->rptr + 1) & (CAPACITY - 1);
-        // Update full flag
-        cb->full = false;
-    }
-
-    return bytesCopied;
+    // The producer can only add data, so the data seen here is safe to read
+    uint32_t tail = cb->tail;
+    size_t length = cb->head - tail;
+    if(count > length) count = length;
+    // Read the data only after the head that published it
+    __DMB();
+
+    // Copy up to the end of the buffer, then the rest from the start
+    size_t offset = tail & (cb->capacity - 1);
+    size_t first = (count < cb->capacity - offset) ? count : cb->capacity - offset;
+    memcpy(buf, &cb->cbfifo[offset * cb->size], first * cb->size);
+    memcpy((char*)buf + first * cb->size, cb->cbfifo, (count - first) * cb->size);
+
+    // Finish reading the data before the producer can reuse its space
+    __DMB();
+    cb->tail = tail + count;
+
+    return count;
 } // cbfifo_dequeue()
 
 
+/**
+ * @brief Reserves free space to be filled in place, without a copy. The
+ *        space is contiguous, so it may be less than the free space when
+ *        that wraps around the end of the buffer. Only the producer may
+ *        call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param buf   - Set to the start of the reserved space
+ *
+ * @return The number of contiguous elements reserved, which could be 0.
+ */
+size_t cbfifo_reserve(cbfifo_t *cb, size_t count, void **buf) {
+	// Check for valid input
+	if(!cb) return 0;
+	if(!buf) return 0;
+
+	// The consumer can only free space, so the space seen here is safe to fill
+	uint32_t head = cb->head;
+	size_t space = cb->capacity - (head - cb->tail);
+	size_t offset = head & (cb->capacity - 1);
+	if(space > cb->capacity - offset) space = cb->capacity - offset;
+	if(count > space) count = space;
+
+	*buf = &cb->cbfifo[offset * cb->size];
+	return count;
+} // cbfifo_reserve()
+
+/**
+ * @brief Enqueues elements written in place into space from
+ *        cbfifo_reserve(). Only the producer may call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Number of elements written, at most the number reserved
+ *
+ * @return none
+ */
+void cbfifo_commit(cbfifo_t *cb, size_t count) {
+	if(!cb) return;
+
+	// Make the data visible before the consumer can see the new head
+	__DMB();
+	cb->head += count;
+} // cbfifo_commit()
+
+/**
+ * @brief Gives access to queued elements in place, without a copy. The
+ *        elements are contiguous, so they may be fewer than the length when
+ *        the data wraps around the end of the buffer. Only the consumer may
+ *        call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param buf   - Set to the oldest element
+ *
+ * @return The number of contiguous elements available, which could be 0.
+ */
+size_t cbfifo_peek(cbfifo_t *cb, size_t count, void **buf) {
+	// Check for valid input
+	if(!cb) return 0;
+	if(!buf) return 0;
+
+	// The producer can only add data, so the data seen here is safe to read
+	uint32_t tail = cb->tail;
+	size_t length = cb->head - tail;
+	size_t offset = tail & (cb->capacity - 1);
+	if(length > cb->capacity - offset) length = cb->capacity - offset;
+	if(count > length) count = length;
+	// Read the data only after the head that published it
+	__DMB();
+
+	*buf = &cb->cbfifo[offset * cb->size];
+	return count;
+} // cbfifo_peek()
+
+/**
+ * @brief Dequeues elements read in place through cbfifo_peek(). Only the
+ *        consumer may call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Number of elements read, at most the number peeked
+ *
+ * @return none
+ */
+void cbfifo_release(cbfifo_t *cb, size_t count) {
+	if(!cb) return;
+
+	// Finish reading the data before the producer can reuse its space
+	__DMB();
+	cb->tail += count;
+} // cbfifo_release()
+
+/**
+ * @brief Enqueues all of the elements or none of them onto a FIFO shared
+ *        by several producers. Safe to call from any interrupt priority,
+ *        the elements of one call are never interleaved with another's.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param buf   - Pointer to the elements to enqueue
+ * @param count - Number of elements to enqueue
+ *
+ * @return count, or 0 if there wasn't space for all of them.
+ */
+size_t cbfifo_enqueue_mp(cbfifo_t *cb, const void *buf, size_t count) {
+	uint32_t masking_state;
+	uint32_t start;
+
+	// Check for valid input
+	if(!cb) return 0;
+	if(!buf) return 0;
+	if(count == 0) return 0;
+
+	// Claim the space, Cortex-M0+ has no exclusive access instructions, so
+	// mask interrupts for the few instructions this takes
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	start = cb->claim;
+	if(count > cb->capacity - (start - cb->tail)) {
+		__set_PRIMASK(masking_state);
+		return 0;
+	}
+	cb->claim = start + count;
+	cb->writers++;
+	__set_PRIMASK(masking_state);
+
+	// Copy up to the end of the buffer, then the rest from the start
+	size_t offset = start & (cb->capacity - 1);
+	size_t first = (count < cb->capacity - offset) ? count : cb->capacity - offset;
+	memcpy(&cb->cbfifo[offset * cb->size], buf, first * cb->size);
+	memcpy(cb->cbfifo, (const char*)buf + first * cb->size, (count - first) * cb->size);
+
+	cbfifo_publish(cb);
+	return count;
+} // cbfifo_enqueue_mp()
+
+/**
+ * @brief Claims contiguous free space on a FIFO shared by several
+ *        producers, to be filled in place. Safe to call from any interrupt
+ *        priority. Unless it returns 0, the claim must be ended with
+ *        cbfifo_publish() from the same context, once every claimed
+ *        element has been written or given back with cbfifo_trim().
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param start - Set to the position of the claim, for cbfifo_trim()
+ * @param buf   - Set to the start of the claimed space
+ *
+ * @return The number of contiguous elements claimed, which could be 0.
+ */
+size_t cbfifo_claim(cbfifo_t *cb, size_t count, uint32_t *start, void **buf) {
+	uint32_t masking_state;
+	uint32_t claim;
+	size_t space, offset;
+
+	// Check for valid input
+	if(!cb) return 0;
+	if(!start) return 0;
+	if(!buf) return 0;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	claim = cb->claim;
+	space = cb->capacity - (claim - cb->tail);
+	offset = claim & (cb->capacity - 1);
+	if(space > cb->capacity - offset) space = cb->capacity - offset;
+	if(count > space) count = space;
+	if(count > 0) {
+		cb->claim = claim + count;
+		cb->writers++;
+	}
+	__set_PRIMASK(masking_state);
+
+	*start = claim;
+	*buf = &cb->cbfifo[offset * cb->size];
+	return count;
+} // cbfifo_claim()
+
+/**
+ * @brief Gives back the unused end of a claim from cbfifo_claim(), keeping
+ *        the first count elements. Only possible while nothing has been
+ *        claimed after it, since the elements are never moved; otherwise
+ *        the caller must fill the unused end with elements the consumer
+ *        skips. Either way the claim is still ended with cbfifo_publish().
+ *
+ * @param cb      - Pointer to circular buffer data structure
+ * @param start   - Position of the claim from cbfifo_claim()
+ * @param claimed - Number of elements claimed
+ * @param count   - Number of elements written, at most claimed
+ *
+ * @return True if the unused end was given back, false otherwise
+ */
+bool cbfifo_trim(cbfifo_t *cb, uint32_t start, size_t claimed, size_t count) {
+	uint32_t masking_state;
+	bool trimmed = false;
+
+	if(!cb) return false;
+	if(count > claimed) return false;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	if(cb->claim == start + claimed) {
+		cb->claim = start + count;
+		trimmed = true;
+	}
+	__set_PRIMASK(masking_state);
+
+	return trimmed;
+} // cbfifo_trim()
+
+/**
+ * @brief Ends a claim from cbfifo_claim() or cbfifo_enqueue_mp(). The
+ *        elements become visible to the consumer once no other producer
+ *        is still writing. Only indices are updated with interrupts
+ *        masked, no elements are moved.
+ *
+ * @param cb - Pointer to circular buffer data structure
+ *
+ * @return none
+ */
+void cbfifo_publish(cbfifo_t *cb) {
+	uint32_t masking_state;
+
+	if(!cb) return;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	// The last producer to finish publishes every claim, all of them are
+	// written by now
+	if(--cb->writers == 0) {
+		__DMB();
+		cb->head = cb->claim;
+	}
+	__set_PRIMASK(masking_state);
+} // cbfifo_publish()
+
 /**
  * @brief Check if the circular buffer is empty.
  *
@@ -128,7 +377,7 @@ size_t cbfifo_dequeue(cbfifo_t *cb, void *buf, size_t nbyte) {
  * @return True for empty, false otherwise.
  */
 bool cbfifo_empty(cbfifo_t *cb) {
-	return (cb->length == 0);
+	return (cb->head == cb->tail);
 } // cbfifo_empty()
 
 /**
@@ -139,50 +388,205 @@ bool cbfifo_empty(cbfifo_t *cb) {
  * @return True for full, false otherwise
  */
 bool cbfifo_full(cbfifo_t *cb) {
-	return (cb->full);
+	return ((cb->head - cb->tail) == cb->capacity);
 } // cbfifo_full()
 
 
 /**
- * @brief Returns the number of bytes currently on the FIFO.
+ * @brief Returns the number of elements currently on the FIFO.
  *
  * @param cb - Pointer to circular buffer data structure
  *
- * @return Number of bytes currently available to be dequeued from the FIFO
+ * @return Number of elements currently available to be dequeued from the FIFO
  */
 size_t cbfifo_length(cbfifo_t *cb) {
-	return (cb->length);
+	return (cb->head - cb->tail);
 } // cbfifo_length()
 
 /**
- * @brief Tests functionality of circular buffer API
+ * @brief Returns the number of elements that can be enqueued right now.
  *
- * @return 0 for success.
+ * @param cb - Pointer to circular buffer data structure
+ *
+ * @return Number of free elements on the FIFO
  */
-int cbfifo_test() {
-	cbfifo_t cb_test;
+size_t cbfifo_space(cbfifo_t *cb) {
+	return cb->capacity - (cb->head - cb->tail);
+} // cbfifo_space()
+
+/**
+ * @brief Measures enqueue and dequeue throughput for 1, 16, 64, and 256
+ *        byte transfers, and prints it in bytes per CPU cycle
+ *
+ * @return none
+ */
+void cbfifo_benchmark() {
+	CBFIFO_DEFINE(cb_bench, char, BENCHMARK_CAPACITY);
+	static char buf_bench[BENCHMARK_CAPACITY] __attribute__((aligned(4)));
+	static const size_t sizes[] = { 1, 16, 64, 256 };
+	uint32_t start, enqueue_ticks, dequeue_ticks;
+
+	for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		cbfifo_init(&cb_bench);
+		// Start part way in, so transfers cross the end of the buffer
+		cb_bench.head = cb_bench.tail = BENCHMARK_CAPACITY / 2 + 3;
+		enqueue_ticks = 0;
+		dequeue_ticks = 0;
+		// Time whole fill and drain passes, a single call is too short to time
+		for(uint32_t pass = 0; pass < BENCHMARK_BYTES / BENCHMARK_CAPACITY; pass++) {
+			start = TIMER_Ticks();
+			for(size_t n = 0; n < BENCHMARK_CAPACITY / sizes[s]; n++) {
+				cbfifo_enqueue(&cb_bench, buf_bench, sizes[s]);
+			}
+			enqueue_ticks += TIMER_Ticks() - start;
+			start = TIMER_Ticks();
+			for(size_t n = 0; n < BENCHMARK_CAPACITY / sizes[s]; n++) {
+				cbfifo_dequeue(&cb_bench, buf_bench, sizes[s]);
+			}
+			dequeue_ticks += TIMER_Ticks() - start;
+		}
+		// SysTick counts at a fraction of the CPU clock
+		printf("cbfifo %3u byte transfers: enqueue %.3f, dequeue %.3f bytes/cycle\n\r", (unsigned)sizes[s],
+				(float)BENCHMARK_BYTES * TIMER_TICKS_PER_MS / ((float)enqueue_ticks * (SYSCLOCK_FREQUENCY / 1000)),
+				(float)BENCHMARK_BYTES * TIMER_TICKS_PER_MS / ((float)dequeue_ticks * (SYSCLOCK_FREQUENCY / 1000)));
+	}
+} // cbfifo_benchmark()
+
+/**
+ * @brief Tests a FIFO of any geometry: init, fill, full, and the free-running
+ *        indices wrapping around 2^32 part way through the buffer
+ *
+ * @param cb  - FIFO to test
+ * @param in  - Scratch buffer of capacity + 1 elements
+ * @param out - Scratch buffer of capacity + 1 elements
+ *
+ * @return none
+ */
+static void cbfifo_test_geometry(cbfifo_t *cb, char *in, char *out) {
+	size_t capacity = cb->capacity;
+	size_t size = cb->size;
+
 	// Test cbfifo_init()
-	cbfifo_init(&cb_test);
-	for(int i = 0; i < CAPACITY; i++) {
-		assert(cb_test.cbfifo[i] == 0);
+	cbfifo_init(cb);
+	for(size_t i = 0; i < capacity * size; i++) {
+		assert(cb->cbfifo[i] == 0);
 	}
-	assert(cb_test.full == false);
-	assert(cb_test.length == 0);
-	assert(cb_test.rptr == 0);
-	assert(cb_test.wptr == 0);
+	assert(cb->head == 0);
+	assert(cb->tail == 0);
 	// Test cbfifo_empty()
-	assert(cbfifo_empty(&cb_test));
+	assert(cbfifo_empty(cb));
+	assert(cbfifo_space(cb) == capacity);
 	// Test cbfifo_enqueue()
-	char buf_test[CAPACITY];
-	memset(buf_test, 'x', CAPACITY);
-	assert(cbfifo_enqueue(&cb_test, buf_test, CAPACITY) == CAPACITY);
+	memset(in, 'x', (capacity + 1) * size);
+	assert(cbfifo_enqueue(cb, in, capacity + 1) == capacity);
 	// Test cbfifo_length()
-	assert(cbfifo_length(&cb_test) == CAPACITY);
+	assert(cbfifo_length(cb) == capacity);
+	assert(cbfifo_space(cb) == 0);
 	// Test cbfifo_full()
-	assert(cbfifo_full(&cb_test));
+	assert(cbfifo_full(cb));
+	assert(cbfifo_enqueue(cb, in, 1) == 0);
 	// Test cbfifo_dequeue()
-	char char_test;
-	assert(cbfifo_dequeue(&cb_test, &char_test, sizeof(char_test)) == sizeof(char_test));
+	assert(cbfifo_dequeue(cb, out, 1) == 1);
+	assert(memcmp(out, in, size) == 0);
+	assert(!cbfifo_full(cb));
+
+	// Test the free-running indices wrapping around 2^32 mid buffer
+	cbfifo_init(cb);
+	cb->head = cb->tail = UINT32_MAX - 2;
+	for(size_t i = 0; i < capacity * size; i++) {
+		in[i] = i * 7 + 1;
+	}
+	size_t part = capacity / 2 + 1;
+	assert(cbfifo_enqueue(cb, in, part) == part);
+	assert(cbfifo_length(cb) == part);
+	assert(cbfifo_enqueue(cb, in + part * size, capacity) == capacity - part);
+	assert(cbfifo_full(cb));
+	assert(cbfifo_dequeue(cb, out, capacity + 1) == capacity);
+	assert(memcmp(out, in, capacity * size) == 0);
+	assert(cbfifo_empty(cb));
+	assert(cbfifo_dequeue(cb, out, 1) == 0);
+} // cbfifo_test_geometry()
+
+/**
+ * @brief Tests functionality of circular buffer API on byte, odd sized, and
+ *        timestamped sample FIFOs of several capacities
+ *
+ * @return 0 for success.
+ */
+int cbfifo_test() {
+	CBFIFO_DEFINE(cb_bytes, char, 256);
+	CBFIFO_DEFINE(cb_small, char, 1);
+	CBFIFO_DEFINE(cb_records, test_record_t, 16);
+	CBFIFO_DEFINE(cb_samples, test_sample_t, 8);
+	static char in_test[257] __attribute__((aligned(4)));
+	static char out_test[257] __attribute__((aligned(4)));
+
+	cbfifo_test_geometry(&cb_bytes, in_test, out_test);
+	cbfifo_test_geometry(&cb_small, in_test, out_test);
+	cbfifo_test_geometry(&cb_records, in_test, out_test);
+	cbfifo_test_geometry(&cb_samples, in_test, out_test);
+
+	// Test reserve/commit and peek/release across the end of the buffer
+	char *space, *data;
+	cbfifo_init(&cb_bytes);
+	cb_bytes.head = cb_bytes.tail = 250;
+	assert(cbfifo_reserve(&cb_bytes, 10, (void**)&space) == 6);
+	assert(space == &cb_bytes.cbfifo[250]);
+	memcpy(space, "abcdef", 6);
+	cbfifo_commit(&cb_bytes, 6);
+	assert(cbfifo_reserve(&cb_bytes, 300, (void**)&space) == 250);
+	assert(space == cb_bytes.cbfifo);
+	memcpy(space, "gh", 2);
+	cbfifo_commit(&cb_bytes, 2);
+	assert(cbfifo_length(&cb_bytes) == 8);
+	assert(cbfifo_peek(&cb_bytes, 100, (void**)&data) == 6);
+	assert(memcmp(data, "abcdef", 6) == 0);
+	cbfifo_release(&cb_bytes, 4);
+	assert(cbfifo_peek(&cb_bytes, 1, (void**)&data) == 1);
+	assert(*data == 'e');
+	assert(cbfifo_dequeue(&cb_bytes, out_test, 10) == 4);
+	assert(memcmp(out_test, "efgh", 4) == 0);
+	assert(cbfifo_peek(&cb_bytes, 1, (void**)&data) == 0);
+
+	// Test producers interrupting each other on a shared FIFO. The outer
+	// producer claims space, and nested producers enqueue and publish
+	// before the outer one is done, as an interrupt would
+	uint32_t start_outer, start_nested;
+	cbfifo_init(&cb_bytes);
+	cb_bytes.head = cb_bytes.tail = cb_bytes.claim = 240;
+	assert(cbfifo_claim(&cb_bytes, 100, &start_outer, (void**)&space) == 16);
+	assert(cbfifo_enqueue_mp(&cb_bytes, "[isr]", 5) == 5);
+	assert(cbfifo_claim(&cb_bytes, 8, &start_nested, (void**)&data) == 8);
+	memcpy(data, "ok", 2);
+	// The nested claim is the last one, so its unused end is given back
+	assert(cbfifo_trim(&cb_bytes, start_nested, 8, 2));
+	cbfifo_publish(&cb_bytes);
+	memcpy(space, "outer", 5);
+	// The outer claim can't be trimmed under the nested ones, so it is padded
+	assert(!cbfifo_trim(&cb_bytes, start_outer, 16, 5));
+	memset(space + 5, 0, 11);
+	// Nothing is visible until the outer producer is done, then all the
+	// messages are whole and in claim order
+	assert(cbfifo_empty(&cb_bytes));
+	cbfifo_publish(&cb_bytes);
+	assert(cbfifo_length(&cb_bytes) == 23);
+	assert(cbfifo_dequeue(&cb_bytes, out_test, 30) == 23);
+	assert(memcmp(out_test, "outer\0\0\0\0\0\0\0\0\0\0\0[isr]ok", 23) == 0);
+	// A shared FIFO takes all of a message or none of it
+	assert(cbfifo_enqueue_mp(&cb_bytes, in_test, 257) == 0);
+	assert(cbfifo_enqueue_mp(&cb_bytes, in_test, 256) == 256);
+	assert(cbfifo_enqueue_mp(&cb_bytes, in_test, 1) == 0);
+	assert(cbfifo_claim(&cb_bytes, 1, &start_nested, (void**)&data) == 0);
+	assert(cb_bytes.writers == 0);
+	assert(cbfifo_full(&cb_bytes));
+
+	// Test typed elements going through whole
+	test_sample_t sample = { -1, 2, 4096, 0x12345678 }, sample_out;
+	cbfifo_init(&cb_samples);
+	assert(cbfifo_enqueue(&cb_samples, &sample, 1) == 1);
+	assert(cbfifo_dequeue(&cb_samples, &sample_out, 1) == 1);
+	assert(sample_out.x == -1 && sample_out.y == 2 && sample_out.z == 4096);
+	assert(sample_out.time == 0x12345678);
 
 	return 0;
 } // test_cbfifo()
@@ -3,7 +3,11 @@
  * @brief Fixed-size FIFO implemented via circular buffer
  *
  * This h file provides functionality for
- * initializing and reading/writing to a circular buffer
+ * initializing and reading/writing to a circular buffer.
+ * Each FIFO has a single producer and a single consumer,
+ * such as an ISR and the main loop, which need no locking.
+ * A FIFO may instead be shared by producers at several interrupt
+ * priorities, which claim space with interrupts briefly masked.
  *
  * @author Maurice Takeda
  * @date November 3, 2022
@@ -17,19 +21,41 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define CAPACITY    256  // Capacity of circular buffer
-
-// Circular Buffer Data Structure
+// Circular Buffer Data Structure. Each FIFO has its own capacity and
+// element size, fixed where it is defined with CBFIFO_DEFINE(). head and
+// tail count every element ever written and read, and wrap around 2^32
+// freely; head - tail is the length. Only the producer writes head, and
+// only the consumer writes tail. With several producers, claim runs ahead
+// of head, and head catches up once no producer is still writing.
 typedef struct cbfifo_s {
-	char     cbfifo[CAPACITY];  // Circular buffer
-	uint32_t length;            // Number of elements currently in the cbfifo
-	uint32_t wptr;              // Write pointer
-	uint32_t rptr;              // Read pointer
-	bool     full;              // Is full flag
+	char             *cbfifo;            // Circular buffer, capacity * size bytes, word aligned for memcpy
+	uint32_t          capacity;          // Capacity in elements, a power of two
+	uint32_t          size;              // Size of an element in bytes
+	volatile uint32_t head;              // Elements enqueued since init
+	volatile uint32_t tail;              // Elements dequeued since init
+	volatile uint32_t claim;             // Elements claimed by producers since init, multiple producers only
+	volatile uint32_t writers;           // Producers with claimed space not yet published, multiple producers only
 } cbfifo_t;
 
 /**
- * @brief Initialize the data in the circular buffer FIFO
+ * @brief Defines a FIFO of capacity elements of the given type, along with
+ *        its storage. The capacity must be a power of two, which is checked
+ *        at compile time. The storage is static at file or block scope.
+ *
+ * @param name     - Name of the cbfifo_t to define
+ * @param type     - Type of an element
+ * @param capacity - Capacity in elements, a power of two
+ */
+#define CBFIFO_DEFINE(name, type, capacity)                                          \
+	_Static_assert((capacity) > 0 && ((capacity) & ((capacity) - 1)) == 0,           \
+	               #name " capacity must be a power of two");                        \
+	static type name##_storage[capacity] __attribute__((aligned(4)));                \
+	cbfifo_t name = { (char *)name##_storage, (capacity), sizeof(type), 0, 0, 0, 0 }
+
+/**
+ * @brief Initialize the data in the circular buffer FIFO, keeping the
+ *        capacity and element size it was defined with. Must not run
+ *        while the producer or consumer may use the FIFO.
  *
  * @param cb - Pointer to circular buffer data structure
  *
@@ -38,30 +64,134 @@ typedef struct cbfifo_s {
 void cbfifo_init(cbfifo_t *cb);
 
 /**
- * @brief Enqueues data onto the FIFO, up to the limit of the available FIFO
- *        capacity.
+ * @brief Enqueues elements onto the FIFO, up to the limit of the available
+ *        FIFO capacity. Only the producer may call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param buf   - Pointer to the elements to enqueue
+ * @param count - Max number of elements to enqueue
+ *
+ * @return The number of elements actually enqueued, which could be 0.
+ */
+size_t cbfifo_enqueue(cbfifo_t *cb, const void *buf, size_t count);
+
+/**
+ * @brief Attempts to remove ("dequeue") up to count elements from the FIFO.
+ *        Removed elements will be copied into the buffer pointed to by buf.
+ *        Only the consumer may call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param buf   - Destination for the dequeued elements
+ * @param count - Elements requested
+ *
+ * @return The number of elements actually copied, which will be between 0
+ *         and count.
+ */
+size_t cbfifo_dequeue(cbfifo_t *cb, void *buf, size_t count);
+
+/**
+ * @brief Reserves free space to be filled in place, without a copy. The
+ *        space is contiguous, so it may be less than the free space when
+ *        that wraps around the end of the buffer. Only the producer may
+ *        call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param buf   - Set to the start of the reserved space
+ *
+ * @return The number of contiguous elements reserved, which could be 0.
+ */
+size_t cbfifo_reserve(cbfifo_t *cb, size_t count, void **buf);
+
+/**
+ * @brief Enqueues elements written in place into space from
+ *        cbfifo_reserve(). Only the producer may call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Number of elements written, at most the number reserved
+ *
+ * @return none
+ */
+void cbfifo_commit(cbfifo_t *cb, size_t count);
+
+/**
+ * @brief Gives access to queued elements in place, without a copy. The
+ *        elements are contiguous, so they may be fewer than the length when
+ *        the data wraps around the end of the buffer. Only the consumer may
+ *        call this.
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param buf   - Set to the oldest element
+ *
+ * @return The number of contiguous elements available, which could be 0.
+ */
+size_t cbfifo_peek(cbfifo_t *cb, size_t count, void **buf);
+
+/**
+ * @brief Dequeues elements read in place through cbfifo_peek(). Only the
+ *        consumer may call this.
  *
  * @param cb    - Pointer to circular buffer data structure
- * @param buf   - Pointer to the data to enqueue
- * @param nbyte - Max number of bytes to enqueue
+ * @param count - Number of elements read, at most the number peeked
  *
- * @return The number of bytes actually enqueued, which could be 0. In case
- *         of an error, returns (size_t) -1.
+ * @return none
  */
-size_t cbfifo_enqueue(cbfifo_t *cb, void *buf, size_t nbyte);
+void cbfifo_release(cbfifo_t *cb, size_t count);
 
 /**
- * @brief Attempts to remove ("dequeue") up to nbyte bytes of data from the
- *        FIFO. Removed data will be copied into the buffer pointed to by buf.
+ * @brief Enqueues all of the elements or none of them onto a FIFO shared
+ *        by several producers. Safe to call from any interrupt priority,
+ *        the elements of one call are never interleaved with another's.
  *
  * @param cb    - Pointer to circular buffer data structure
- * @param buf   - Destination for the dequeued data
- * @param nbyte - Bytes of data requested
+ * @param buf   - Pointer to the elements to enqueue
+ * @param count - Number of elements to enqueue
  *
- * @return The number of bytes actually copied, which will be between 0 and
- *         nbyte.
+ * @return count, or 0 if there wasn't space for all of them.
  */
-size_t cbfifo_dequeue(cbfifo_t *cb, void *buf, size_t nbyte);
+size_t cbfifo_enqueue_mp(cbfifo_t *cb, const void *buf, size_t count);
+
+/**
+ * @brief Claims contiguous free space on a FIFO shared by several
+ *        producers, to be filled in place. Safe to call from any interrupt
+ *        priority. Unless it returns 0, the claim must be ended with
+ *        cbfifo_publish() from the same context, once every claimed
+ *        element has been written or given back with cbfifo_trim().
+ *
+ * @param cb    - Pointer to circular buffer data structure
+ * @param count - Max number of elements wanted
+ * @param start - Set to the position of the claim, for cbfifo_trim()
+ * @param buf   - Set to the start of the claimed space
+ *
+ * @return The number of contiguous elements claimed, which could be 0.
+ */
+size_t cbfifo_claim(cbfifo_t *cb, size_t count, uint32_t *start, void **buf);
+
+/**
+ * @brief Gives back the unused end of a claim from cbfifo_claim(), keeping
+ *        the first count elements. Only possible while nothing has been
+ *        claimed after it; otherwise the caller must fill the unused end
+ *        with elements the consumer skips.
+ *
+ * @param cb      - Pointer to circular buffer data structure
+ * @param start   - Position of the claim from cbfifo_claim()
+ * @param claimed - Number of elements claimed
+ * @param count   - Number of elements written, at most claimed
+ *
+ * @return True if the unused end was given back, false otherwise
+ */
+bool cbfifo_trim(cbfifo_t *cb, uint32_t start, size_t claimed, size_t count);
+
+/**
+ * @brief Ends a claim from cbfifo_claim(). The elements become visible
+ *        to the consumer once no other producer is still writing.
+ *
+ * @param cb - Pointer to circular buffer data structure
+ *
+ * @return none
+ */
+void cbfifo_publish(cbfifo_t *cb);
 
 /**
  * @brief Check if the circular buffer is empty.
@@ -82,14 +212,31 @@ bool cbfifo_empty(cbfifo_t *cb);
 bool cbfifo_full(cbfifo_t *cb);
 
 /**
- * @brief Returns the number of bytes currently on the FIFO.
+ * @brief Returns the number of elements currently on the FIFO.
  *
  * @param cb - Pointer to circular buffer data structure
  *
- * @return Number of bytes currently available to be dequeued from the FIFO
+ * @return Number of elements currently available to be dequeued from the FIFO
  */
 size_t cbfifo_length(cbfifo_t *cb);
 
+/**
+ * @brief Returns the number of elements that can be enqueued right now.
+ *
+ * @param cb - Pointer to circular buffer data structure
+ *
+ * @return Number of free elements on the FIFO
+ */
+size_t cbfifo_space(cbfifo_t *cb);
+
+/**
+ * @brief Measures enqueue and dequeue throughput for 1, 16, 64, and 256
+ *        byte transfers, and prints it in bytes per CPU cycle
+ *
+ * @return none
+ */
+void cbfifo_benchmark();
+
 /**
  * @brief Tests functionality of circular buffer API
  *
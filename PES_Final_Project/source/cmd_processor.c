@@ -17,9 +17,28 @@
 #include <string.h>
 #include <stdbool.h>
 #include "rgb_led.h"
+#include "i2c.h"
+#include "timers.h"
+#include "accelerometer.h"
+#include "filter.h"
+#include "spectrum.h"
+#include "power.h"
+#include "nvstore.h"
 #include "cmd_processor.h"
 
 
+#define MAX_TOKENS          24    // Max number of tokens in a command, including the command name
+#define MIN_PRINT_INTERVAL  10    // Shortest print interval in ms
+#define MAX_PRINT_INTERVAL  60000 // Longest print interval in ms, keeps the statistics sums from overflowing
+#define MAX_DWELL_TIME      60000 // Longest minimum on or off time in ms
+#define DEFAULT_IDLE_TIME   5     // Default time without motion in s before the accelerometer sleeps
+#define MAX_IDLE_TIME       81    // Longest time without motion in s before the accelerometer sleeps
+#define DEFAULT_CAL_SAMPLES 256   // Default number of samples averaged by the calibrate command
+#define MIN_CAL_SAMPLES     16    // Fewest samples averaged by the calibrate command
+#define MAX_CAL_SAMPLES     4096  // Most samples averaged by the calibrate command
+#define DEFAULT_ODR_FLOOR   0.2f  // Default standard deviation floor in m/s^2 of the adaptive ODR
+#define MAX_ODR_FLOOR       10.0f // Largest standard deviation floor in m/s^2 of the adaptive ODR
+
 typedef void (*command_handler_t)(int, char *argv[]);
 
 typedef struct {
@@ -31,7 +50,18 @@ typedef struct {
 static const command_table_t commands[] = {
 	{ .name="color"       , .handler=handle_color        },
 	{ .name="acceleration", .handler=handle_acceleration },
-	{ .name="print"       , .handler=handle_print        }
+	{ .name="hysteresis"  , .handler=handle_hysteresis   },
+	{ .name="print"       , .handler=handle_print        },
+	{ .name="mode"        , .handler=handle_mode         },
+	{ .name="resolution"  , .handler=handle_resolution   },
+	{ .name="range"       , .handler=handle_range        },
+	{ .name="odr"         , .handler=handle_odr          },
+	{ .name="filter"      , .handler=handle_filter       },
+	{ .name="fft"         , .handler=handle_fft          },
+	{ .name="i2c"         , .handler=handle_i2c          },
+	{ .name="calibrate"   , .handler=handle_calibrate    },
+	{ .name="lowpower"    , .handler=handle_lowpower     },
+	{ .name="idle"        , .handler=handle_idle         }
 };
 
 static const int num_commands = sizeof(commands) / sizeof(command_table_t);
@@ -52,8 +82,9 @@ void accumulate_line() {
 	char character = getchar();
 	if(character == EOF) return;
 
-	if(print_acceleration) {
+	if(print_acceleration || spectrum_active()) {
 		print_acceleration = false;
+		spectrum_stop();
 		printf("\n\r");
 		printf("> ");
 	}
@@ -100,7 +131,7 @@ void process_command(char *input) {
 
 	// Tokenize input in place
 	bool in_token = false;
-	char *argv[10];
+	char *argv[MAX_TOKENS + 1];
 	memset(argv, 0, sizeof(argv));
 	int argc = 0;
 	for(p = input; p < end; p++) {
@@ -119,6 +150,10 @@ void process_command(char *input) {
 		else {
 			// And if we are not already in a token
 			if(!in_token) {
+				if(argc == MAX_TOKENS) {
+					printf("Invalid input: Too many arguments\n\r");
+					return;
+				}
 				// This marks the start of a new token, so
 				// add this new token to argv[]
 				argv[argc] = p;
@@ -142,6 +177,24 @@ void process_command(char *input) {
 	printf("Unknown command: %s\n\r", input);
 } // process_command()
 
+/**
+ * @brief Reports a failed accelerometer register write to the user. The
+ *        registers that were not written stay pending, and are written
+ *        when the command is repeated.
+ *
+ * @param status - Status returned by the accelerometer setter
+ *
+ * @return True if the write succeeded, false if it failed
+ */
+static bool accel_write_ok(i2c_status_t status) {
+	static const char *reasons[] = { "ok", "no acknowledge", "arbitration lost", "timeout", "bus busy" }; // Indexed by i2c_status_t
+
+	if(status == I2C_OK) return true;
+	printf("Accelerometer write failed (%s), the setting is not in effect yet. Repeat the command to retry\n\r",
+			reasons[status]);
+	return false;
+} // accel_write_ok()
+
 /**
  * @brief Handles the reception of a set color command from the user.
  *
@@ -197,6 +250,10 @@ void handle_color(int argc, char *argv[]) {
 	target_r_val = r;
 	target_g_val = g;
 	target_b_val = b;
+	// Show the new color right away if the target is currently reached
+	if(led_detector.on && accelerometer_get_mode() != ACCEL_MODE_TRANSIENT) {
+		RGB_LED_SetColor(r, g, b);
+	}
 	printf("Target color set to r=%d, g=%d, b=%d\n\r", r, g ,b);
 } // handle_color()
 
@@ -230,11 +287,88 @@ void handle_acceleration(int argc, char *argv[]) {
 		printf("Invalid argument: The target acceleration argument must be greater than or equal to zero\n\r");
 		return;
 	}
+	if(hysteresis_band > 0 && target <= hysteresis_band) {
+		printf("Invalid argument: The target acceleration must be greater than the hysteresis band of %f m/s^2, lower the band first\n\r",
+				hysteresis_band);
+		return;
+	}
 
 	target_acceleration = target;
+	target_threshold_sq = acceleration_threshold_sq(target);
+	detector_configure(&led_detector, target, hysteresis_band, min_on_time, min_off_time);
+	if(!accel_write_ok(accelerometer_set_transient_threshold(target))) return;
 	printf("Target acceleration set to %f m/s^2\n\r", target);
 } // handle_acceleration()
 
+/**
+ * @brief Handles the reception of a set hysteresis command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_hysteresis(int argc, char *argv[]) {
+	// Hysteresis command requires a band argument, plus optional min on and min off times
+	if(argc < 2 || argc > 4) {
+		printf("Invalid argument: The hysteresis command requires a band argument\n\r");
+		printf("E.g. hysteresis <band in m/s^2> [min on time in ms] [min off time in ms]\n\r");
+		return;
+	}
+
+	int status, on_time = min_on_time, off_time = min_off_time;
+	float band;
+
+	// Check for validity of band argument
+	status = sscanf(argv[1], "%f", &band);
+	if(status != 1) {
+		printf("Invalid argument: Check for correctness of the band argument\n\r");
+		printf("Example: hysteresis 0.5 100 50\n\r");
+		return;
+	}
+	if(band < 0) {
+		printf("Invalid argument: The band argument must be greater than or equal to zero\n\r");
+		return;
+	}
+	if(band > 0 && band >= target_acceleration) {
+		printf("Invalid argument: The band argument must be less than the target acceleration of %f m/s^2\n\r",
+				target_acceleration);
+		return;
+	}
+	// Check for validity of min on time argument
+	if(argc > 2) {
+		status = sscanf(argv[2], "%d", &on_time);
+		if(status != 1) {
+			printf("Invalid argument: Check for correctness of the min on time argument\n\r");
+			printf("Example: hysteresis 0.5 100 50\n\r");
+			return;
+		}
+		if(on_time < 0 || on_time > MAX_DWELL_TIME) {
+			printf("Invalid argument: The min on time argument must be between 0 and %d ms\n\r", MAX_DWELL_TIME);
+			return;
+		}
+	}
+	// Check for validity of min off time argument
+	if(argc > 3) {
+		status = sscanf(argv[3], "%d", &off_time);
+		if(status != 1) {
+			printf("Invalid argument: Check for correctness of the min off time argument\n\r");
+			printf("Example: hysteresis 0.5 100 50\n\r");
+			return;
+		}
+		if(off_time < 0 || off_time > MAX_DWELL_TIME) {
+			printf("Invalid argument: The min off time argument must be between 0 and %d ms\n\r", MAX_DWELL_TIME);
+			return;
+		}
+	}
+
+	hysteresis_band = band;
+	min_on_time = on_time;
+	min_off_time = off_time;
+	detector_configure(&led_detector, target_acceleration, band, on_time, off_time);
+	printf("Hysteresis set to %f m/s^2, min on = %d ms, min off = %d ms\n\r", band, on_time, off_time);
+} // handle_hysteresis()
+
 /**
  * @brief Handles the reception of a print acceleration data command from the user.
  *
@@ -244,11 +378,528 @@ void handle_acceleration(int argc, char *argv[]) {
  * @return none
  */
 void handle_print(int argc, char *argv[]) {
-	// Print command requires zero arguments
-	if(argc != 1) {
-		printf("Invalid argument: The print command does not take any arguments\n\r");
+	int status, interval = 1000;
+
+	// Print command takes an optional interval argument
+	if(argc > 2) {
+		printf("Invalid argument: The print command takes an optional interval argument\n\r");
+		printf("E.g. print <interval in ms>\n\r");
 		return;
 	}
 
+	// Check for validity of interval argument
+	if(argc == 2) {
+		status = sscanf(argv[1], "%d", &interval);
+		if(status != 1) {
+			printf("Invalid argument: Check for correctness of the interval argument\n\r");
+			printf("Example: print 100\n\r");
+			return;
+		}
+		if(interval < MIN_PRINT_INTERVAL || interval > MAX_PRINT_INTERVAL) {
+			printf("Invalid argument: The interval argument must be between %d and %d ms\n\r",
+					MIN_PRINT_INTERVAL, MAX_PRINT_INTERVAL);
+			return;
+		}
+	}
+
+	print_interval = interval;
+	// Start the first interval now
+	stats_reset(&print_stats);
+	TIMER_Reset();
 	print_acceleration = true;
 } // handle_print()
+
+/**
+ * @brief Handles the reception of a set acceleration mode command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_mode(int argc, char *argv[]) {
+	// Mode command requires one argument, plus an optional cutoff for hpf
+	if(argc < 2 || argc > 3) {
+		printf("Invalid argument: The mode command requires a planar, gravity, hpf, or hardware argument\n\r");
+		printf("E.g. mode gravity\n\r");
+		printf("E.g. mode hpf <cutoff of 16, 8, 4, or 2 Hz>\n\r");
+		return;
+	}
+
+	if(strcasecmp(argv[1], "hpf") == 0) {
+		static const int cutoffs_hz[] = { 16, 8, 4, 2 }; // Indexed by accel_hpf_cutoff_t
+		int status, cutoff, sel;
+
+		if(argc == 3) {
+			// Check for validity of cutoff argument
+			status = sscanf(argv[2], "%d", &cutoff);
+			if(status != 1) {
+				printf("Invalid argument: Check for correctness of the cutoff argument\n\r");
+				printf("Example: mode hpf 4\n\r");
+				return;
+			}
+			for(sel = 0; sel < 4; sel++) {
+				if(cutoffs_hz[sel] == cutoff) break;
+			}
+			if(sel == 4) {
+				printf("Invalid argument: The cutoff argument must be 16, 8, 4, or 2\n\r");
+				return;
+			}
+			if(!accel_write_ok(accelerometer_set_hpf_cutoff((accel_hpf_cutoff_t)sel))) return;
+		}
+		if(!accel_write_ok(accelerometer_set_mode(ACCEL_MODE_HPF))) return;
+		printf("Mode set to hpf: gravity is filtered out by the sensor with a %d Hz cutoff\n\r",
+				cutoffs_hz[accelerometer_get_hpf_cutoff()]);
+		return;
+	}
+	if(argc != 2) {
+		printf("Invalid argument: Only the hpf mode takes a cutoff argument\n\r");
+		return;
+	}
+
+	if(strcasecmp(argv[1], "planar") == 0) {
+		if(!accel_write_ok(accelerometer_set_mode(ACCEL_MODE_PLANAR))) return;
+		printf("Mode set to planar: keep the board flat\n\r");
+	}
+	else if(strcasecmp(argv[1], "gravity") == 0) {
+		if(!accel_write_ok(accelerometer_set_mode(ACCEL_MODE_GRAVITY))) return;
+		printf("Mode set to gravity: gravity is removed from all three axes\n\r");
+	}
+	else if(strcasecmp(argv[1], "hardware") == 0) {
+		if(!accel_write_ok(accelerometer_set_mode(ACCEL_MODE_TRANSIENT))) return;
+		printf("Mode set to hardware: the accelerometer detects the target acceleration\n\r");
+	}
+	else {
+		printf("Invalid argument: The mode argument must be planar, gravity, hpf, or hardware\n\r");
+	}
+} // handle_mode()
+
+/**
+ * @brief Handles the reception of a set acquisition resolution command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_resolution(int argc, char *argv[]) {
+	int status, bits;
+
+	// Resolution command requires one argument
+	if(argc != 2) {
+		printf("Invalid argument: The resolution command requires a resolution argument\n\r");
+		printf("E.g. resolution <14 or 8 bits>\n\r");
+		return;
+	}
+
+	// Check for validity of resolution argument
+	status = sscanf(argv[1], "%d", &bits);
+	if(status != 1) {
+		printf("Invalid argument: Check for correctness of the resolution argument\n\r");
+		printf("Example: resolution 8\n\r");
+		return;
+	}
+	if(bits != 14 && bits != 8) {
+		printf("Invalid argument: The resolution argument must be 14 or 8\n\r");
+		return;
+	}
+
+	if(!accel_write_ok(accelerometer_set_resolution((bits == 8) ? ACCEL_RESOLUTION_8BIT : ACCEL_RESOLUTION_14BIT))) return;
+	printf("Resolution set to %d bits\n\r", bits);
+} // handle_resolution()
+
+/**
+ * @brief Handles the reception of a set full-scale range command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_range(int argc, char *argv[]) {
+	int status, g;
+
+	// Range command requires one argument
+	if(argc != 2) {
+		printf("Invalid argument: The range command requires a range argument\n\r");
+		printf("E.g. range <2, 4, or 8 g, or auto>\n\r");
+		return;
+	}
+
+	if(strcasecmp(argv[1], "auto") == 0) {
+		if(!accel_write_ok(accelerometer_set_auto_range(true))) return;
+		printf("Range set to auto, currently %d g\n\r", 2 << accelerometer_get_range());
+		return;
+	}
+
+	// Check for validity of range argument
+	status = sscanf(argv[1], "%d", &g);
+	if(status != 1) {
+		printf("Invalid argument: Check for correctness of the range argument\n\r");
+		printf("Example: range 4\n\r");
+		return;
+	}
+	if(g != 2 && g != 4 && g != 8) {
+		printf("Invalid argument: The range argument must be 2, 4, 8, or auto\n\r");
+		return;
+	}
+
+	if(!accel_write_ok(accelerometer_set_range((g == 2) ? ACCEL_RANGE_2G : (g == 4) ? ACCEL_RANGE_4G : ACCEL_RANGE_8G))) return;
+	printf("Range set to %d g\n\r", g);
+} // handle_range()
+
+/**
+ * @brief Handles the reception of a set output data rate command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_odr(int argc, char *argv[]) {
+	int status, hz;
+	float floor_mps2 = DEFAULT_ODR_FLOOR;
+
+	// ODR command requires one or two arguments
+	if(argc < 2 || argc > 3) {
+		printf("Invalid argument: The odr command requires an odr argument\n\r");
+		printf("E.g. odr <%d or adaptive> [floor in m/s^2]\n\r", ACCEL_ODR_HZ);
+		return;
+	}
+
+	if(strcasecmp(argv[1], "adaptive") == 0) {
+		// Check for validity of optional floor argument
+		if(argc == 3) {
+			status = sscanf(argv[2], "%f", &floor_mps2);
+			if(status != 1) {
+				printf("Invalid argument: Check for correctness of the floor argument\n\r");
+				printf("Example: odr adaptive 0.3\n\r");
+				return;
+			}
+			if(floor_mps2 <= 0 || floor_mps2 > MAX_ODR_FLOOR) {
+				printf("Invalid argument: The floor must be greater than 0 and at most %.1f m/s^2\n\r", MAX_ODR_FLOOR);
+				return;
+			}
+		}
+		if(!accel_write_ok(accelerometer_set_adaptive_odr(true, floor_mps2))) return;
+		printf("ODR set to adaptive, %d Hz below a floor of %f m/s^2, %d Hz above\n\r",
+				ACCEL_ODR_LOW_HZ, floor_mps2, ACCEL_ODR_HZ);
+		return;
+	}
+
+	// Check for validity of odr argument
+	status = sscanf(argv[1], "%d", &hz);
+	if(status != 1 || argc != 2) {
+		printf("Invalid argument: Check for correctness of the odr argument\n\r");
+		printf("Example: odr %d\n\r", ACCEL_ODR_HZ);
+		return;
+	}
+	if(hz != ACCEL_ODR_HZ) {
+		printf("Invalid argument: The odr argument must be %d or adaptive\n\r", ACCEL_ODR_HZ);
+		return;
+	}
+
+	if(!accel_write_ok(accelerometer_set_adaptive_odr(false, DEFAULT_ODR_FLOOR))) return;
+	printf("ODR set to %d Hz\n\r", hz);
+} // handle_odr()
+
+/**
+ * @brief Handles the reception of a set filter command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_filter(int argc, char *argv[]) {
+	q15_t coeffs[FILTER_MAX_STAGES * FILTER_BIQUAD_COEFFS];
+	int status, value, num_coeffs, post_shift;
+
+	if(argc == 2 && strcasecmp(argv[1], "off") == 0) {
+		filter_disable();
+		printf("Filter disabled\n\r");
+		return;
+	}
+
+	// Biquad filter takes a post shift then 5 coefficients per section
+	if(argc >= 3 && strcasecmp(argv[1], "biquad") == 0) {
+		num_coeffs = argc - 3;
+		if(num_coeffs == 0 || (num_coeffs % FILTER_BIQUAD_COEFFS) != 0 ||
+		   num_coeffs > FILTER_MAX_STAGES * FILTER_BIQUAD_COEFFS) {
+			printf("Invalid argument: The biquad filter requires b0 b1 b2 a1 a2 for each of 1 to %d sections\n\r",
+					FILTER_MAX_STAGES);
+			return;
+		}
+		status = sscanf(argv[2], "%d", &post_shift);
+		if(status != 1 || post_shift < 0 || post_shift > 15) {
+			printf("Invalid argument: The post shift argument must be between 0 and 15\n\r");
+			return;
+		}
+	}
+	// FIR filter takes one coefficient per tap
+	else if(argc >= 3 && strcasecmp(argv[1], "fir") == 0) {
+		num_coeffs = argc - 2;
+		if(num_coeffs > FILTER_MAX_TAPS) {
+			printf("Invalid argument: The fir filter takes 1 to %d coefficients\n\r", FILTER_MAX_TAPS);
+			return;
+		}
+	}
+	else {
+		printf("Invalid argument: The filter command requires an off, biquad, or fir argument\n\r");
+		printf("E.g. filter biquad <post shift> <b0> <b1> <b2> <a1> <a2> [...]\n\r");
+		printf("E.g. filter fir <b0> <b1> [...]\n\r");
+		return;
+	}
+
+	// Check for validity of the Q15 coefficient arguments
+	for(int i = 0; i < num_coeffs; i++) {
+		status = sscanf(argv[argc - num_coeffs + i], "%d", &value);
+		if(status != 1 || value < INT16_MIN || value > INT16_MAX) {
+			printf("Invalid argument: Coefficients must be Q15 integers between %d and %d\n\r", INT16_MIN, INT16_MAX);
+			return;
+		}
+		coeffs[i] = value;
+	}
+
+	if(strcasecmp(argv[1], "biquad") == 0) {
+		filter_set_biquad(num_coeffs / FILTER_BIQUAD_COEFFS, coeffs, post_shift);
+		printf("Filter set to %d biquad section(s) with post shift %d\n\r", num_coeffs / FILTER_BIQUAD_COEFFS, post_shift);
+	}
+	else {
+		filter_set_fir(num_coeffs, coeffs);
+		printf("Filter set to %d tap fir\n\r", num_coeffs);
+	}
+} // handle_filter()
+
+/**
+ * @brief Handles the reception of a print spectrum command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_fft(int argc, char *argv[]) {
+	spectrum_axis_t axis = SPECTRUM_AXIS_Z;
+	int status, size;
+
+	// Fft command requires a block size and an optional axis
+	if(argc < 2 || argc > 3) {
+		printf("Invalid argument: The fft command requires a block size argument\n\r");
+		printf("E.g. fft <128|256|512> [x|y|z]\n\r");
+		return;
+	}
+
+	// Check for validity of block size argument
+	status = sscanf(argv[1], "%d", &size);
+	if(status != 1 || (size != 128 && size != 256 && size != 512)) {
+		printf("Invalid argument: The block size argument must be 128, 256, or 512\n\r");
+		return;
+	}
+	// Check for validity of axis argument
+	if(argc == 3) {
+		if(strcasecmp(argv[2], "x") == 0)      axis = SPECTRUM_AXIS_X;
+		else if(strcasecmp(argv[2], "y") == 0) axis = SPECTRUM_AXIS_Y;
+		else if(strcasecmp(argv[2], "z") == 0) axis = SPECTRUM_AXIS_Z;
+		else {
+			printf("Invalid argument: The axis argument must be x, y, or z\n\r");
+			return;
+		}
+	}
+	if(accelerometer_get_mode() == ACCEL_MODE_TRANSIENT) {
+		printf("Invalid mode: No samples are read in hardware mode\n\r");
+		return;
+	}
+
+	spectrum_start(size, axis);
+	printf("Spectrum of %d samples (%.1f Hz resolution), %d bands of %d Hz. Press any key to stop\n\r",
+			size, (float)ACCEL_ODR_HZ / size, SPECTRUM_NUM_BANDS, ACCEL_ODR_HZ / 2 / SPECTRUM_NUM_BANDS);
+} // handle_fft()
+
+/**
+ * @brief Handles the reception of a print I2C error counters command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_i2c(int argc, char *argv[]) {
+	static ticktime_t last_time = 0;    // Time of the previous report
+	static uint32_t   last_bytes = 0;   // Bus byte count at the previous report
+	static uint32_t   last_samples = 0; // Sample count at the previous report
+	i2c_errors_t errors;
+	ticktime_t now = TIMER_Now();
+	uint32_t bytes = i2c_get_byte_count();
+	uint32_t samples = accelerometer_get_sample_count();
+	float elapsed_s = (now - last_time) / 1000.0f;
+
+	// I2C command takes no arguments
+	if(argc != 1) {
+		printf("Invalid argument: The i2c command takes no arguments\n\r");
+		return;
+	}
+
+	i2c_get_errors(&errors);
+	printf("I2C naks = %lu, arbitration lost = %lu, timeouts = %lu, bus recoveries = %lu\n\r",
+			(unsigned long)errors.naks, (unsigned long)errors.arb_lost,
+			(unsigned long)errors.timeouts, (unsigned long)errors.recoveries);
+	// Throughput since the previous report, each byte takes 9 SCL clocks
+	if(elapsed_s > 0) {
+		printf("%d bit samples/s = %f, bus utilisation = %f%% over the last %f s\n\r",
+				(accelerometer_get_resolution() == ACCEL_RESOLUTION_8BIT) ? 8 : 14,
+				(samples - last_samples) / elapsed_s,
+				((bytes - last_bytes) * 9 * 100.0f) / (elapsed_s * I2C_BAUD), elapsed_s);
+	}
+	last_time = now;
+	last_bytes = bytes;
+	last_samples = samples;
+} // handle_i2c()
+
+/**
+ * @brief Handles the reception of a calibrate offsets command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_calibrate(int argc, char *argv[]) {
+	int status, num_samples = DEFAULT_CAL_SAMPLES;
+	nvstore_t record;
+
+	// Calibrate command takes one optional argument
+	if(argc > 2) {
+		printf("Invalid argument: The calibrate command takes one optional argument\n\r");
+		printf("E.g. calibrate [number of samples]\n\r");
+		return;
+	}
+
+	// Check for validity of optional number of samples argument
+	if(argc == 2) {
+		status = sscanf(argv[1], "%d", &num_samples);
+		if(status != 1) {
+			printf("Invalid argument: Check for correctness of the number of samples argument\n\r");
+			printf("Example: calibrate 512\n\r");
+			return;
+		}
+		if(num_samples < MIN_CAL_SAMPLES || num_samples > MAX_CAL_SAMPLES) {
+			printf("Invalid argument: The number of samples must be between %d and %d\n\r",
+					MIN_CAL_SAMPLES, MAX_CAL_SAMPLES);
+			return;
+		}
+	}
+
+	if(accelerometer_get_mode() == ACCEL_MODE_HPF || accelerometer_get_mode() == ACCEL_MODE_TRANSIENT) {
+		printf("Invalid argument: Calibration needs unfiltered samples, select planar or gravity mode first\n\r");
+		return;
+	}
+
+	printf("Calibrating, keep the board flat and still...\n\r");
+	if(accelerometer_calibrate(num_samples, record.offsets) != 0) {
+		printf("Calibration failed: no samples from the accelerometer, or the offsets could not be written\n\r");
+		return;
+	}
+	printf("Offsets set to x=%d, y=%d, z=%d mg\n\r",
+			record.offsets[0] * 2, record.offsets[1] * 2, record.offsets[2] * 2);
+
+	// Interrupts are off while the flash is written, so let the I2C transfer
+	// under way complete first rather than lose its interrupts
+	accelerometer_pause();
+	status = nvstore_save(&record);
+	accel_write_ok(accelerometer_resume());
+	if(status != 0) {
+		printf("Offsets could not be saved to flash, they will be lost on reset\n\r");
+		return;
+	}
+	printf("Offsets saved to flash\n\r");
+} // handle_calibrate()
+
+/**
+ * @brief Handles the reception of a set low power mode command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_lowpower(int argc, char *argv[]) {
+	int status, idle_s = DEFAULT_IDLE_TIME;
+	bool enable;
+
+	// Low power command requires one or two arguments
+	if(argc < 2 || argc > 3) {
+		printf("Invalid argument: The lowpower command requires an on or off argument\n\r");
+		printf("E.g. lowpower <on|off> [idle time in s]\n\r");
+		return;
+	}
+
+	if(strcasecmp(argv[1], "on") == 0) {
+		enable = true;
+	}
+	else if(strcasecmp(argv[1], "off") == 0) {
+		enable = false;
+	}
+	else {
+		printf("Invalid argument: The lowpower argument must be on or off\n\r");
+		return;
+	}
+
+	// Check for validity of optional idle time argument
+	if(argc == 3) {
+		status = sscanf(argv[2], "%d", &idle_s);
+		if(status != 1 || !enable) {
+			printf("Invalid argument: Check for correctness of the idle time argument\n\r");
+			printf("Example: lowpower on 10\n\r");
+			return;
+		}
+		if(idle_s < 1 || idle_s > MAX_IDLE_TIME) {
+			printf("Invalid argument: The idle time must be between 1 and %d s\n\r", MAX_IDLE_TIME);
+			return;
+		}
+	}
+
+	if(!accel_write_ok(accelerometer_set_auto_sleep(enable, idle_s * 1000))) return;
+	power_set_low_power(enable);
+	if(enable) {
+		printf("Low power on, the MCU stops %d s after the last motion\n\r", idle_s);
+	}
+	else {
+		printf("Low power off\n\r");
+	}
+	printf("MCU time in VLPS so far = %lu ms\n\r", (unsigned long)power_get_sleep_time());
+} // handle_lowpower()
+
+/**
+ * @brief Handles the reception of a print idle time command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_idle(int argc, char *argv[]) {
+	static ticktime_t last_time = 0;  // Time of the previous report
+	static uint32_t   last_idle = 0;  // Idle time at the previous report
+	static uint32_t   last_sleep = 0; // VLPS time at the previous report
+	ticktime_t now = TIMER_Now();
+	uint32_t idle = power_get_idle_time();
+	uint32_t sleep = power_get_sleep_time();
+	uint32_t elapsed = now - last_time;
+
+	// Idle command takes no arguments
+	if(argc != 1) {
+		printf("Invalid argument: The idle command takes no arguments\n\r");
+		return;
+	}
+
+	// Headroom since the previous report
+	if(elapsed > 0) {
+		printf("Idle = %f%% (VLPS = %f%%) over the last %f s\n\r",
+				(idle - last_idle) * 100.0f / elapsed,
+				(sleep - last_sleep) * 100.0f / elapsed, elapsed / 1000.0f);
+	}
+	last_time = now;
+	last_idle = idle;
+	last_sleep = sleep;
+} // handle_idle()
@@ -14,6 +14,9 @@
 #ifndef CMD_PROCESSOR_H_
 #define CMD_PROCESSOR_H_
 
+#include "stats.h"
+#include "detector.h"
+
 /**
  * @brief Accumulates characters received over UART into a string.
  *        Calls process_command() upon receiving the '\r' character,
@@ -55,6 +58,16 @@ void handle_color(int argc, char *argv[]);
  */
 void handle_acceleration(int argc, char *argv[]);
 
+/**
+ * @brief Handles the reception of a set hysteresis command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_hysteresis(int argc, char *argv[]);
+
 /**
  * @brief Handles the reception of a print acceleration data command from the user.
  *
@@ -65,10 +78,117 @@ void handle_acceleration(int argc, char *argv[]);
  */
 void handle_print(int argc, char *argv[]);
 
+/**
+ * @brief Handles the reception of a set acceleration mode command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_mode(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a set acquisition resolution command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_resolution(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a set full-scale range command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_range(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a set output data rate command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_odr(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a set filter command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_filter(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a print spectrum command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_fft(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a print I2C error counters command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_i2c(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a calibrate offsets command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_calibrate(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a set low power mode command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_lowpower(int argc, char *argv[]);
+
+/**
+ * @brief Handles the reception of a print idle time command from the user.
+ *
+ * @param argc   - Number of tokens contained in argv[]
+ * @param argv[] - Array of pointers to the start of the character arrays for each token
+ *
+ * @return none
+ */
+void handle_idle(int argc, char *argv[]);
+
 extern uint8_t target_r_val;
 extern uint8_t target_g_val;
 extern uint8_t target_b_val;
 extern float   target_acceleration;
+extern uint32_t target_threshold_sq;
+extern float   hysteresis_band;
+extern uint32_t min_on_time;
+extern uint32_t min_off_time;
+extern detector_t led_detector;
 extern bool    print_acceleration;
+extern uint32_t print_interval;
+extern stats_t print_stats;
 
 #endif /* CMD_PROCESSOR_H_ */
@@ -0,0 +1,280 @@
+/**
+ * @file detector.c
+ * @brief Acceleration detector state machine
+ *
+ * This c file provides functionality for
+ * deciding whether the target acceleration has been
+ * reached, with a hysteresis band and minimum dwell times.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include "sysclock.h"
+#include "timers.h"
+#include "accelerometer.h"
+#include "detector.h"
+
+
+#define BENCHMARK_SAMPLES  (256)   // Samples in the benchmark trace
+#define BENCHMARK_PASSES   (16)    // Times the benchmark trace is run through
+#define BENCHMARK_TARGET   (10.0f) // Target acceleration of the benchmark in m/s^2, the default
+
+/**
+ * @brief Convert an acceleration into a squared magnitude threshold so
+ *        samples can be checked without a square root or floating point.
+ *        It is worked out in double, in float the rounding of the counts
+ *        and of their square moves the threshold for most targets.
+ *
+ * @param acceleration - Acceleration in m/s^2
+ *
+ * @return Smallest squared magnitude in counts^2 at or above acceleration
+ */
+uint32_t acceleration_threshold_sq(float acceleration) {
+	double counts = ((double)acceleration / ACCEL_STANDARD_GRAVITY) * ACCEL_COUNTS_PER_G;
+	double counts_sq = ceil(counts * counts);
+
+	// Thresholds beyond the sensor range can never be reached
+	if(counts_sq >= (double)UINT32_MAX) return UINT32_MAX;
+
+	return (uint32_t)counts_sq;
+} // acceleration_threshold_sq()
+
+/**
+ * @brief Convert a squared magnitude into an acceleration. Only needed
+ *        when the value is displayed.
+ *
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ *
+ * @return linear acceleration in units of m/s^2
+ */
+float acceleration_mps2(uint32_t magnitude_sq) {
+	return (sqrtf(magnitude_sq) * ACCEL_STANDARD_GRAVITY) / ACCEL_COUNTS_PER_G;
+} // acceleration_mps2()
+
+/**
+ * @brief Initialize the detector in the off state
+ *
+ * @param detector - Pointer to detector data structure
+ *
+ * @return none
+ */
+void detector_init(detector_t *detector) {
+	// Check for validity of detector
+	if(!detector) return;
+
+	detector->on_threshold_sq = UINT32_MAX;
+	detector->off_threshold_sq = UINT32_MAX;
+	detector->min_on_samples = 0;
+	detector->min_off_samples = 0;
+	detector->step = 1;
+	detector->dwell = 0;
+	detector->transitions = 0;
+	detector->on = false;
+} // detector_init()
+
+/**
+ * @brief Configure the detector thresholds and dwell times. The detector
+ *        turns on at the target acceleration and off below the target
+ *        minus the hysteresis band. A band that reaches down to zero
+ *        turns it off only at zero acceleration, so it can always turn
+ *        off. The current state is kept.
+ *
+ * @param detector   - Pointer to detector data structure
+ * @param target     - Target acceleration in m/s^2
+ * @param band       - Hysteresis band in m/s^2
+ * @param min_on_ms  - Minimum time in ms to stay on
+ * @param min_off_ms - Minimum time in ms to stay off
+ *
+ * @return none
+ */
+void detector_configure(detector_t *detector, float target, float band, uint32_t min_on_ms, uint32_t min_off_ms) {
+	// Check for validity of detector
+	if(!detector) return;
+
+	detector->on_threshold_sq = acceleration_threshold_sq(target);
+	detector->off_threshold_sq = (band < target) ? acceleration_threshold_sq(target - band) : 1;
+	if(detector->off_threshold_sq > detector->on_threshold_sq) {
+		detector->off_threshold_sq = detector->on_threshold_sq;
+	}
+	detector->min_on_samples = (min_on_ms * ACCEL_ODR_HZ) / 1000;
+	detector->min_off_samples = (min_off_ms * ACCEL_ODR_HZ) / 1000;
+} // detector_configure()
+
+/**
+ * @brief Set the ODR of the samples that follow, so the dwell times stay
+ *        the same in ms
+ *
+ * @param detector - Pointer to detector data structure
+ * @param odr      - ODR in Hz, at most ACCEL_ODR_HZ
+ *
+ * @return none
+ */
+void detector_set_odr(detector_t *detector, uint16_t odr) {
+	// Check for validity of detector
+	if(!detector || odr == 0 || odr > ACCEL_ODR_HZ) return;
+
+	detector->step = ACCEL_ODR_HZ / odr;
+} // detector_set_odr()
+
+/**
+ * @brief Update the detector with one sample
+ *
+ * @param detector     - Pointer to detector data structure
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ *
+ * @return True if the detector changed state, false otherwise
+ */
+bool detector_update(detector_t *detector, uint32_t magnitude_sq) {
+	bool change;
+
+	if(detector->dwell <= UINT32_MAX - detector->step) detector->dwell += detector->step;
+
+	if(detector->on) {
+		change = (magnitude_sq < detector->off_threshold_sq) && (detector->dwell > detector->min_on_samples);
+	}
+	else {
+		change = (magnitude_sq >= detector->on_threshold_sq) && (detector->dwell > detector->min_off_samples);
+	}
+
+	if(change) {
+		detector->on = !detector->on;
+		detector->dwell = 0;
+		detector->transitions++;
+	}
+
+	return change;
+} // detector_update()
+
+/**
+ * @brief Calculate the linear acceleration of a sample the way the
+ *        detector did before the squared magnitude compare: X and Y
+ *        truncated to 4 counts, a square root in double, and a float
+ *        compare in m/s^2
+ *
+ * @param sample - Sample in 14 bit counts
+ *
+ * @return linear acceleration in units of m/s^2
+ */
+static float sqrt_acceleration(const accel_sample_t *sample) {
+	int16_t acc_x = sample->x / 4;
+	int16_t acc_y = sample->y / 4;
+	float linear_acc = sqrt((acc_x * acc_x) + (acc_y * acc_y));
+
+	return (linear_acc * 9.80665) / 1000;
+} // sqrt_acceleration()
+
+/**
+ * @brief Measure the CPU cycles per sample of the squared magnitude
+ *        compare against the square root in double the detector used
+ *        before, and print them
+ *
+ * @return none
+ */
+void detector_benchmark() {
+	static accel_sample_t trace[BENCHMARK_SAMPLES];
+	uint32_t threshold_sq = acceleration_threshold_sq(BENCHMARK_TARGET);
+	uint32_t start, compare_ticks = 0, sqrt_ticks = 0;
+	uint32_t compare_hits = 0, sqrt_hits = 0;
+
+	// A flat trace wandering around the target, about 4177 counts
+	for(int i = 0; i < BENCHMARK_SAMPLES; i++) {
+		trace[i].x = 3000 + (i * 37) % 400 - 200;
+		trace[i].y = 2900 + (i * 53) % 400 - 200;
+		trace[i].z = 0;
+	}
+	// Time whole passes, a single sample is too short to time
+	for(int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+		start = TIMER_Ticks();
+		for(int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			compare_hits += ((uint32_t)(trace[i].x * trace[i].x) + (uint32_t)(trace[i].y * trace[i].y) >= threshold_sq);
+		}
+		compare_ticks += TIMER_Ticks() - start;
+		start = TIMER_Ticks();
+		for(int i = 0; i < BENCHMARK_SAMPLES; i++) {
+			sqrt_hits += (sqrt_acceleration(&trace[i]) >= BENCHMARK_TARGET);
+		}
+		sqrt_ticks += TIMER_Ticks() - start;
+	}
+	// SysTick counts at a fraction of the CPU clock
+	printf("detector compare %.1f, sqrt %.1f cycles/sample, at target %lu and %lu of %u samples\n\r",
+			(float)compare_ticks * (SYSCLOCK_FREQUENCY / 1000) / ((float)TIMER_TICKS_PER_MS * BENCHMARK_SAMPLES * BENCHMARK_PASSES),
+			(float)sqrt_ticks * (SYSCLOCK_FREQUENCY / 1000) / ((float)TIMER_TICKS_PER_MS * BENCHMARK_SAMPLES * BENCHMARK_PASSES),
+			(unsigned long)compare_hits, (unsigned long)sqrt_hits, BENCHMARK_SAMPLES * BENCHMARK_PASSES);
+} // detector_benchmark()
+
+/**
+ * @brief Tests functionality of the detector state machine
+ *
+ * @return 0 for success.
+ */
+int detector_test() {
+	detector_t detector;
+	uint32_t on_sq = acceleration_threshold_sq(2.0);
+	uint32_t off_sq = acceleration_threshold_sq(1.5);
+
+	// Test detector_init()
+	detector_init(&detector);
+	assert(!detector.on);
+	assert(detector.transitions == 0);
+	assert(!detector_update(&detector, UINT32_MAX - 1));
+
+	// Without hysteresis or dwell a trace hugging the target flips every sample
+	detector_configure(&detector, 2.0, 0, 0, 0);
+	for(int i = 0; i < 100; i++) {
+		detector_update(&detector, (i & 1) ? on_sq - 1 : on_sq);
+	}
+	assert(detector.transitions == 100);
+	assert(!detector.on);
+
+	// With a hysteresis band the same trace turns on once and stays on
+	detector_init(&detector);
+	detector_configure(&detector, 2.0, 0.5, 0, 0);
+	for(int i = 0; i < 100; i++) {
+		detector_update(&detector, (i & 1) ? on_sq - 1 : on_sq);
+	}
+	assert(detector.transitions == 1);
+	assert(detector.on);
+	// Only dropping below the band turns it off
+	assert(!detector_update(&detector, off_sq));
+	assert(detector_update(&detector, off_sq - 1));
+	assert(!detector.on);
+
+	// A band as wide as the target still lets the detector turn off, at zero
+	detector_init(&detector);
+	detector_configure(&detector, 2.0, 2.0, 0, 0);
+	assert(detector_update(&detector, on_sq));
+	assert(!detector_update(&detector, 1));
+	assert(detector_update(&detector, 0));
+	assert(!detector.on);
+	detector_configure(&detector, 2.0, 5.0, 0, 0);
+	assert(detector_update(&detector, on_sq));
+	assert(detector_update(&detector, 0));
+
+	// A trace crossing the whole band every sample is limited by the dwell times
+	// 10 ms on and 5 ms off at 800 Hz is 8 and 4 samples
+	detector_init(&detector);
+	detector_configure(&detector, 2.0, 0.5, 10, 5);
+	for(int i = 0; i < 100; i++) {
+		detector_update(&detector, (i & 1) ? 0 : on_sq);
+	}
+	// One on transition after 5 samples off, then a cycle every 9 + 5 samples
+	assert(detector.transitions == 14);
+
+	// At 50 Hz each sample lasts 20 ms, longer than either dwell time, so
+	// the same trace changes state on every sample
+	detector_init(&detector);
+	detector_configure(&detector, 2.0, 0.5, 10, 5);
+	detector_set_odr(&detector, ACCEL_ODR_LOW_HZ);
+	for(int i = 0; i < 100; i++) {
+		detector_update(&detector, (i & 1) ? 0 : on_sq);
+	}
+	assert(detector.transitions == 100);
+
+	return 0;
+} // detector_test()
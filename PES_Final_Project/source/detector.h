@@ -0,0 +1,113 @@
+/**
+ * @file detector.h
+ * @brief Acceleration detector state machine
+ *
+ * This h file provides functionality for
+ * deciding whether the target acceleration has been
+ * reached, with a hysteresis band and minimum dwell times.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#ifndef DETECTOR_H_
+#define DETECTOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Detector Data Structure
+typedef struct detector_s {
+	uint32_t on_threshold_sq;   // Squared magnitude in counts^2 at or above which the detector turns on
+	uint32_t off_threshold_sq;  // Squared magnitude in counts^2 below which the detector turns off
+	uint32_t min_on_samples;    // Samples at ACCEL_ODR_HZ the detector stays on before it may turn off
+	uint32_t min_off_samples;   // Samples at ACCEL_ODR_HZ the detector stays off before it may turn on
+	uint32_t step;              // Samples at ACCEL_ODR_HZ per sample at the current ODR
+	uint32_t dwell;             // Samples at ACCEL_ODR_HZ since the last transition
+	uint32_t transitions;       // Number of transitions since init
+	bool     on;                // True when the target acceleration has been reached
+} detector_t;
+
+/**
+ * @brief Convert an acceleration into a squared magnitude threshold so
+ *        samples can be checked without a square root or floating point.
+ *
+ * @param acceleration - Acceleration in m/s^2
+ *
+ * @return Smallest squared magnitude in counts^2 at or above acceleration
+ */
+uint32_t acceleration_threshold_sq(float acceleration);
+
+/**
+ * @brief Convert a squared magnitude into an acceleration. Only needed
+ *        when the value is displayed.
+ *
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ *
+ * @return linear acceleration in units of m/s^2
+ */
+float acceleration_mps2(uint32_t magnitude_sq);
+
+/**
+ * @brief Initialize the detector in the off state
+ *
+ * @param detector - Pointer to detector data structure
+ *
+ * @return none
+ */
+void detector_init(detector_t *detector);
+
+/**
+ * @brief Configure the detector thresholds and dwell times. The detector
+ *        turns on at the target acceleration and off below the target
+ *        minus the hysteresis band. The current state is kept.
+ *
+ * @param detector   - Pointer to detector data structure
+ * @param target     - Target acceleration in m/s^2
+ * @param band       - Hysteresis band in m/s^2
+ * @param min_on_ms  - Minimum time in ms to stay on
+ * @param min_off_ms - Minimum time in ms to stay off
+ *
+ * @return none
+ */
+void detector_configure(detector_t *detector, float target, float band, uint32_t min_on_ms, uint32_t min_off_ms);
+
+/**
+ * @brief Set the ODR of the samples that follow, so the dwell times stay
+ *        the same in ms
+ *
+ * @param detector - Pointer to detector data structure
+ * @param odr      - ODR in Hz, at most ACCEL_ODR_HZ
+ *
+ * @return none
+ */
+void detector_set_odr(detector_t *detector, uint16_t odr);
+
+/**
+ * @brief Update the detector with one sample
+ *
+ * @param detector     - Pointer to detector data structure
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ *
+ * @return True if the detector changed state, false otherwise
+ */
+bool detector_update(detector_t *detector, uint32_t magnitude_sq);
+
+/**
+ * @brief Measure the CPU cycles per sample of the squared magnitude
+ *        compare against the square root in double the detector used
+ *        before, and print them
+ *
+ * @return none
+ */
+void detector_benchmark();
+
+/**
+ * @brief Tests functionality of the detector state machine
+ *
+ * @return 0 for success.
+ */
+int detector_test();
+
+#endif /* DETECTOR_H_ */
@@ -0,0 +1,344 @@
+/**
+ * @file filter.c
+ * @brief Q15 filter stage for the acceleration stream
+ *
+ * This c file provides functionality for
+ * filtering blocks of accelerometer samples with a
+ * biquad cascade or FIR filter before detection.
+ *
+ * The kernels follow the CMSIS-DSP Q15 arithmetic (64 bit
+ * accumulator, truncating shift, saturation to 16 bits) of
+ * arm_biquad_cascade_df1_q15() and arm_fir_q15(). The project
+ * ships the CMSIS-DSP headers but not the prebuilt library, so
+ * the kernels are built here. filter_test() checks them against
+ * impulse and step responses worked out by hand.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ * @references CMSIS-DSP arm_biquad_cascade_df1_q15 and arm_fir_q15
+ *
+ */
+#include <string.h>
+#include <assert.h>
+#include "filter.h"
+
+
+#define NUM_AXES  3
+
+static filter_type_t filter_type   = FILTER_NONE; // Configured filter stage type
+static uint8_t       biquad_stages = 0;         // Number of biquad sections
+static int8_t        biquad_shift  = 0;         // Biquad output shift in bits
+static uint16_t      fir_taps      = 0;         // Number of FIR taps
+static uint16_t      filter_odr    = ACCEL_ODR_HZ; // ODR of the samples being filtered in Hz
+
+static q15_t biquad_coeffs[FILTER_MAX_STAGES * FILTER_BIQUAD_COEFFS];
+static q15_t biquad_state[NUM_AXES][FILTER_MAX_STAGES * 4];
+static q15_t fir_coeffs[FILTER_MAX_TAPS];                              // Time reversed
+static q15_t fir_state[NUM_AXES][FILTER_MAX_TAPS + FILTER_BLOCK_SIZE - 1];
+static q15_t axis_block[FILTER_BLOCK_SIZE];                            // One axis of the block being filtered
+
+
+/**
+ * @brief Saturate a 32 bit value to Q15
+ *
+ * @param value - Value to saturate
+ *
+ * @return Saturated value
+ */
+static inline q15_t saturate_q15(q31_t value) {
+	if(value > INT16_MAX) return INT16_MAX;
+	if(value < INT16_MIN) return INT16_MIN;
+	return (q15_t)value;
+} // saturate_q15()
+
+/**
+ * @brief Direct form I biquad cascade over a block of Q15 samples, in
+ *        place. Arithmetic matches arm_biquad_cascade_df1_q15().
+ *
+ * @param state - 4 * biquad_stages state values (x[n-1], x[n-2], y[n-1], y[n-2])
+ * @param data  - Samples to filter
+ * @param count - Number of samples
+ *
+ * @return none
+ */
+static void biquad_cascade_df1_q15(q15_t *state, q15_t *data, uint32_t count) {
+	const q15_t *coeffs = biquad_coeffs;
+	int32_t shift = 15 - biquad_shift;
+
+	for(uint8_t stage = 0; stage < biquad_stages; stage++) {
+		q15_t b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2];
+		q15_t a1 = coeffs[3], a2 = coeffs[4];
+		q15_t x1 = state[0], x2 = state[1], y1 = state[2], y2 = state[3];
+
+		for(uint32_t i = 0; i < count; i++) {
+			q15_t in = data[i];
+			q63_t acc = (q31_t)b0 * in;
+			acc += (q31_t)b1 * x1;
+			acc += (q31_t)b2 * x2;
+			acc += (q31_t)a1 * y1;
+			acc += (q31_t)a2 * y2;
+			q15_t out = saturate_q15((q31_t)(acc >> shift));
+			x2 = x1;
+			x1 = in;
+			y2 = y1;
+			y1 = out;
+			data[i] = out;
+		}
+
+		state[0] = x1;
+		state[1] = x2;
+		state[2] = y1;
+		state[3] = y2;
+		state += 4;
+		coeffs += FILTER_BIQUAD_COEFFS;
+	}
+} // biquad_cascade_df1_q15()
+
+/**
+ * @brief FIR filter over a block of Q15 samples, in place. Arithmetic
+ *        matches arm_fir_q15().
+ *
+ * @param state - fir_taps + count - 1 state values
+ * @param data  - Samples to filter
+ * @param count - Number of samples
+ *
+ * @return none
+ */
+static void fir_q15(q15_t *state, q15_t *data, uint32_t count) {
+	// New samples go after the fir_taps - 1 samples kept from the last block
+	memcpy(&state[fir_taps - 1], data, count * sizeof(q15_t));
+
+	for(uint32_t i = 0; i < count; i++) {
+		q63_t acc = 0;
+		for(uint16_t tap = 0; tap < fir_taps; tap++) {
+			acc += (q31_t)state[i + tap] * fir_coeffs[tap];
+		}
+		data[i] = saturate_q15((q31_t)(acc >> 15));
+	}
+
+	// Keep the last fir_taps - 1 samples for the next block
+	memmove(state, &state[count], (fir_taps - 1) * sizeof(q15_t));
+} // fir_q15()
+
+/**
+ * @brief Disable the filter stage so samples pass through unchanged
+ *
+ * @return none
+ */
+void filter_disable() {
+	filter_type = FILTER_NONE;
+} // filter_disable()
+
+/**
+ * @brief Configure the filter stage as a cascade of direct form I biquad
+ *        sections. Coefficients are in Q15 and ordered b0, b1, b2, a1, a2
+ *        per section, where y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] +
+ *        a1*y[n-1] + a2*y[n-2] (CMSIS-DSP sign convention for a1 and a2).
+ *        The accumulator is shifted left by post_shift before saturation
+ *        so coefficients of magnitude up to 2^post_shift can be used.
+ *
+ * @param num_stages - Number of biquad sections, 1 to FILTER_MAX_STAGES
+ * @param coeffs     - Array of num_stages * FILTER_BIQUAD_COEFFS coefficients
+ * @param post_shift - Output shift in bits, 0 to 15
+ *
+ * @return 0 for success, -1 for invalid arguments
+ */
+int filter_set_biquad(uint8_t num_stages, const q15_t *coeffs, int8_t post_shift) {
+	if(!coeffs) return -1;
+	if(num_stages < 1 || num_stages > FILTER_MAX_STAGES) return -1;
+	if(post_shift < 0 || post_shift > 15) return -1;
+
+	memcpy(biquad_coeffs, coeffs, num_stages * FILTER_BIQUAD_COEFFS * sizeof(q15_t));
+	memset(biquad_state, 0, sizeof(biquad_state));
+	biquad_stages = num_stages;
+	biquad_shift = post_shift;
+	filter_type = FILTER_BIQUAD;
+
+	return 0;
+} // filter_set_biquad()
+
+/**
+ * @brief Configure the filter stage as a FIR filter. Coefficients are in
+ *        Q15 and ordered b0 to b[num_taps - 1].
+ *
+ * @param num_taps - Number of taps, 1 to FILTER_MAX_TAPS
+ * @param coeffs   - Array of num_taps coefficients
+ *
+ * @return 0 for success, -1 for invalid arguments
+ */
+int filter_set_fir(uint8_t num_taps, const q15_t *coeffs) {
+	if(!coeffs) return -1;
+	if(num_taps < 1 || num_taps > FILTER_MAX_TAPS) return -1;
+
+	// Coefficients are stored time reversed, as CMSIS-DSP expects
+	for(uint8_t i = 0; i < num_taps; i++) {
+		fir_coeffs[i] = coeffs[num_taps - 1 - i];
+	}
+	memset(fir_state, 0, sizeof(fir_state));
+	fir_taps = num_taps;
+	filter_type = FILTER_FIR;
+
+	return 0;
+} // filter_set_fir()
+
+/**
+ * @brief Get the type of the configured filter stage
+ *
+ * @return Filter stage type
+ */
+filter_type_t filter_get_type() {
+	return filter_type;
+} // filter_get_type()
+
+/**
+ * @brief Set the ODR of the samples that follow. The coefficients are
+ *        designed for ACCEL_ODR_HZ, so at any other ODR samples pass
+ *        through unchanged. The filter state is cleared on a change, so
+ *        samples at different rates are never mixed.
+ *
+ * @param odr - ODR in Hz
+ *
+ * @return none
+ */
+void filter_set_odr(uint16_t odr) {
+	if(odr == filter_odr) return;
+
+	memset(biquad_state, 0, sizeof(biquad_state));
+	memset(fir_state, 0, sizeof(fir_state));
+	filter_odr = odr;
+} // filter_set_odr()
+
+/**
+ * @brief Filter a block of samples in place, each axis independently.
+ *        Filter state carries over between blocks.
+ *
+ * @param samples     - Samples to filter
+ * @param num_samples - Number of samples, at most FILTER_BLOCK_SIZE
+ *
+ * @return none
+ */
+void filter_block(accel_sample_t *samples, uint32_t num_samples) {
+	if(filter_type == FILTER_NONE || filter_odr != ACCEL_ODR_HZ) return;
+	if(num_samples > FILTER_BLOCK_SIZE) num_samples = FILTER_BLOCK_SIZE;
+
+	for(uint8_t axis = 0; axis < NUM_AXES; axis++) {
+		// Gather one axis so the kernel runs over contiguous samples
+		for(uint32_t i = 0; i < num_samples; i++) {
+			axis_block[i] = (axis == 0) ? samples[i].x : (axis == 1) ? samples[i].y : samples[i].z;
+		}
+
+		if(filter_type == FILTER_BIQUAD) {
+			biquad_cascade_df1_q15(biquad_state[axis], axis_block, num_samples);
+		}
+		else {
+			fir_q15(fir_state[axis], axis_block, num_samples);
+		}
+
+		for(uint32_t i = 0; i < num_samples; i++) {
+			if(axis == 0)      samples[i].x = axis_block[i];
+			else if(axis == 1) samples[i].y = axis_block[i];
+			else               samples[i].z = axis_block[i];
+		}
+	}
+} // filter_block()
+
+/**
+ * @brief Run a test trace through filter_block() on the x and y axes,
+ *        with z held at 0, and check the axes are filtered alike
+ *
+ * @param in    - Input trace
+ * @param out   - Filtered trace
+ * @param count - Number of samples, at most FILTER_BLOCK_SIZE
+ *
+ * @return none
+ */
+static void filter_test_block(const int16_t *in, int16_t *out, uint32_t count) {
+	accel_sample_t samples[FILTER_BLOCK_SIZE];
+
+	for(uint32_t i = 0; i < count; i++) {
+		samples[i].x = in[i];
+		samples[i].y = in[i];
+		samples[i].z = 0;
+	}
+	filter_block(samples, count);
+	for(uint32_t i = 0; i < count; i++) {
+		assert(samples[i].y == samples[i].x);
+		assert(samples[i].z == 0);
+		out[i] = samples[i].x;
+	}
+} // filter_test_block()
+
+/**
+ * @brief Tests the biquad and FIR kernels against impulse and step
+ *        responses worked out by hand with the CMSIS-DSP Q15 arithmetic
+ *
+ * @return 0 for success.
+ */
+int filter_test() {
+	// FIR 0.5, 0.25, 0.125
+	const q15_t fir_test[] = { 16384, 8192, 4096 };
+	// One section y[n] = 0.5 x[n] + 0.5 y[n-1]
+	const q15_t biquad_test[] = { 16384, 0, 0, 16384, 0 };
+	// Two sections of gain 0.5 each, scaled up by post_shift 1
+	const q15_t biquad_shift_test[] = { 16384, 0, 0, 0, 0, 16384, 0, 0, 0, 0 };
+	// One section of gain just under 2 with post_shift 1
+	const q15_t biquad_saturate_test[] = { 32767, 0, 0, 0, 0 };
+	int16_t impulse[8] = { 16384 };
+	int16_t step[8] = { 1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000 };
+	int16_t out[8];
+
+	filter_set_odr(ACCEL_ODR_HZ);
+
+	// FIR impulse response is the taps, split over two blocks to check
+	// that the state carries over
+	assert(filter_set_fir(3, fir_test) == 0);
+	filter_test_block(impulse, out, 2);
+	filter_test_block(impulse + 2, out + 2, 6);
+	assert(out[0] == 8192 && out[1] == 4096 && out[2] == 2048 && out[3] == 0);
+	// FIR step response settles at 0.875
+	assert(filter_set_fir(3, fir_test) == 0);
+	filter_test_block(step, out, 8);
+	assert(out[0] == 500 && out[1] == 750 && out[2] == 875 && out[7] == 875);
+	// The shift truncates toward minus infinity, -0.5 becomes -1
+	assert(filter_set_fir(1, fir_test) == 0);
+	impulse[0] = -1;
+	filter_test_block(impulse, out, 1);
+	assert(out[0] == -1);
+	impulse[0] = 16384;
+
+	// Biquad impulse response halves every sample
+	assert(filter_set_biquad(1, biquad_test, 0) == 0);
+	filter_test_block(impulse, out, 3);
+	filter_test_block(impulse + 3, out + 3, 5);
+	assert(out[0] == 8192 && out[1] == 4096 && out[2] == 2048 && out[3] == 1024 && out[7] == 64);
+	// Biquad step response, truncation settles it at 999 rather than 1000
+	assert(filter_set_biquad(1, biquad_test, 0) == 0);
+	filter_test_block(step, out, 8);
+	assert(out[0] == 500 && out[1] == 750 && out[2] == 875 && out[3] == 937 && out[4] == 968);
+	for(int i = 0; i < 4; i++) {
+		filter_test_block(step, out, 8);
+	}
+	assert(out[7] == 999);
+	// post_shift scales each section by 2, so the cascade passes the step
+	assert(filter_set_biquad(2, biquad_shift_test, 1) == 0);
+	filter_test_block(step, out, 8);
+	assert(out[0] == 1000 && out[7] == 1000);
+	// Output saturates to 16 bits
+	assert(filter_set_biquad(1, biquad_saturate_test, 1) == 0);
+	impulse[0] = 20000;
+	filter_test_block(impulse, out, 2);
+	assert(out[0] == INT16_MAX && out[1] == 0);
+	impulse[0] = -20000;
+	filter_test_block(impulse, out, 1);
+	assert(out[0] == INT16_MIN);
+
+	// Invalid configurations are refused
+	assert(filter_set_fir(0, fir_test) == -1);
+	assert(filter_set_fir(FILTER_MAX_TAPS + 1, fir_test) == -1);
+	assert(filter_set_biquad(FILTER_MAX_STAGES + 1, biquad_test, 0) == -1);
+	assert(filter_set_biquad(1, biquad_test, 16) == -1);
+
+	filter_disable();
+	return 0;
+} // filter_test()
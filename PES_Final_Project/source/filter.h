@@ -0,0 +1,110 @@
+/**
+ * @file filter.h
+ * @brief Q15 filter stage for the acceleration stream
+ *
+ * This h file provides functionality for
+ * filtering blocks of accelerometer samples with a
+ * biquad cascade or FIR filter before detection.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ * @references CMSIS-DSP arm_biquad_cascade_df1_q15 and arm_fir_q15
+ *
+ */
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+#include "accelerometer.h"
+
+#ifndef ARM_MATH_CM0PLUS
+#define ARM_MATH_CM0PLUS
+#endif
+#include "arm_math.h"
+
+#define FILTER_MAX_STAGES     4                 // Max number of biquad sections
+#define FILTER_MAX_TAPS       16                // Max number of FIR taps
+#define FILTER_BLOCK_SIZE     ACCEL_FIFO_DEPTH  // Max number of samples per filtered block
+#define FILTER_BIQUAD_COEFFS  5                 // b0, b1, b2, a1, a2 per biquad section
+
+// Filter stage types
+typedef enum filter_type_e {
+	FILTER_NONE,    // Samples pass through unfiltered
+	FILTER_BIQUAD,  // Direct form I biquad cascade
+	FILTER_FIR      // Direct form FIR
+} filter_type_t;
+
+/**
+ * @brief Disable the filter stage so samples pass through unchanged
+ *
+ * @return none
+ */
+void filter_disable();
+
+/**
+ * @brief Configure the filter stage as a cascade of direct form I biquad
+ *        sections. Coefficients are in Q15 and ordered b0, b1, b2, a1, a2
+ *        per section, where y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] +
+ *        a1*y[n-1] + a2*y[n-2] (CMSIS-DSP sign convention for a1 and a2).
+ *        The accumulator is shifted left by post_shift before saturation
+ *        so coefficients of magnitude up to 2^post_shift can be used.
+ *
+ * @param num_stages - Number of biquad sections, 1 to FILTER_MAX_STAGES
+ * @param coeffs     - Array of num_stages * FILTER_BIQUAD_COEFFS coefficients
+ * @param post_shift - Output shift in bits, 0 to 15
+ *
+ * @return 0 for success, -1 for invalid arguments
+ */
+int filter_set_biquad(uint8_t num_stages, const q15_t *coeffs, int8_t post_shift);
+
+/**
+ * @brief Configure the filter stage as a FIR filter. Coefficients are in
+ *        Q15 and ordered b0 to b[num_taps - 1].
+ *
+ * @param num_taps - Number of taps, 1 to FILTER_MAX_TAPS
+ * @param coeffs   - Array of num_taps coefficients
+ *
+ * @return 0 for success, -1 for invalid arguments
+ */
+int filter_set_fir(uint8_t num_taps, const q15_t *coeffs);
+
+/**
+ * @brief Get the type of the configured filter stage
+ *
+ * @return Filter stage type
+ */
+filter_type_t filter_get_type();
+
+/**
+ * @brief Set the ODR of the samples that follow. The coefficients are
+ *        designed for ACCEL_ODR_HZ, so at any other ODR samples pass
+ *        through unchanged. The filter state is cleared on a change, so
+ *        samples at different rates are never mixed.
+ *
+ * @param odr - ODR in Hz
+ *
+ * @return none
+ */
+void filter_set_odr(uint16_t odr);
+
+/**
+ * @brief Filter a block of samples in place, each axis independently.
+ *        Filter state carries over between blocks.
+ *
+ * @param samples     - Samples to filter
+ * @param num_samples - Number of samples, at most FILTER_BLOCK_SIZE
+ *
+ * @return none
+ */
+void filter_block(accel_sample_t *samples, uint32_t num_samples);
+
+/**
+ * @brief Tests the biquad and FIR kernels against impulse and step
+ *        responses worked out by hand with the CMSIS-DSP Q15 arithmetic
+ *
+ * @return 0 for success.
+ */
+int filter_test();
+
+#endif /* FILTER_H_ */
@@ -3,7 +3,9 @@
  * @brief I2C driver
  *
  * This c file provides functionality for
- * utilizing i2c.
+ * utilizing i2c. Transfers are queued and run
+ * by the I2C0 interrupt one byte at a time, with
+ * long reads moved into RAM by DMA channel 0.
  *
  * @author Maurice Takeda
  * @date November 3, 2022
@@ -11,7 +13,11 @@
  * @references The Dean Textbook
  *
  */
+#include <stddef.h>
+#include <stdio.h>
 #include "MKL25Z4.h"
+#include "sysclock.h"
+#include "timers.h"
 #include "i2c.h"
 
 
@@ -20,11 +26,50 @@
 #define I2C_M_RSTART    I2C0->C1 |= I2C_C1_RSTA_MASK
 #define I2C_TRAN        I2C0->C1 |= I2C_C1_TX_MASK
 #define I2C_REC         I2C0->C1 &= ~I2C_C1_TX_MASK
-#define I2C_WAIT        while((I2C0->S & I2C_S_IICIF_MASK)==0) {} \
-	                    	I2C0->S |= I2C_S_IICIF_MASK;
 #define NACK            I2C0->C1 |= I2C_C1_TXAK_MASK
 #define ACK             I2C0->C1 &= ~I2C_C1_TXAK_MASK
 
+// Above PORTA and SysTick, so bus progress preempts the handlers that call
+// i2c_submit(). Handlers must not use the blocking calls: TIMER_Now() doesn't
+// advance inside them, so the transfer timeout would never fire
+#define I2C_PRIORITY    1
+
+#define DMA_CHANNEL        0  // DMA channel used for I2C0 receive
+#define DMA_SOURCE_I2C0    22 // DMAMUX request source for I2C0
+#define DMA_MIN_COUNT      4  // Reads of at least this many bytes use DMA
+#define DMA_TAIL_COUNT     2  // Bytes at the end of a DMA read left to the byte interrupt, for the NACK
+#define BENCHMARK_RUNS     16 // Reads timed per receive path by i2c_benchmark()
+#define BENCHMARK_LOOPS    10000 // Idle loops timed to get the cost of one loop
+#define CYCLES_PER_TICK    (SYSCLOCK_FREQUENCY / 1000 / TIMER_TICKS_PER_MS) // CPU cycles per SysTick count
+
+#define SCL_PIN            24   // I2C0 SCL is PTE24
+#define SDA_PIN            25   // I2C0 SDA is PTE25
+#define RECOVERY_PULSES    9    // SCL pulses that free a slave stuck in any byte
+#define RECOVERY_DELAY     40   // Delay loop iterations per SCL half period, about 10 us
+#define LINE_LOW(pin)      PTE->PDDR |= (1 << (pin))  // Drive the line low (PDOR is cleared)
+#define LINE_RELEASE(pin)  PTE->PDDR &= ~(1 << (pin)) // Let the pull-up take the line high
+
+// Transaction engine states, named after the byte whose completion raises IICIF next
+typedef enum {
+	I2C_STATE_IDLE,    // No transfer in progress
+	I2C_STATE_DEV_W,   // Device address (write) sent
+	I2C_STATE_REG,     // Register address sent
+	I2C_STATE_TX,      // Data byte sent
+	I2C_STATE_DEV_R,   // Device address (read) sent after the repeated start
+	I2C_STATE_RX,      // Data byte received
+	I2C_STATE_RX_DMA   // Data bytes being moved by DMA, DMA0_IRQHandler() hands the last two back to I2C_STATE_RX
+} i2c_state_t;
+
+static i2c_transfer_t       queue[I2C_QUEUE_SIZE]; // Queued transfers, queue[head] is in progress
+static uint8_t              head = 0;
+static uint8_t              length = 0;
+static volatile i2c_state_t state = I2C_STATE_IDLE;
+static uint16_t             byte_index = 0;        // Bytes transferred so far in the current transfer
+static ticktime_t           transfer_start = 0;    // Time the current transfer was started
+static i2c_errors_t         error_counts;          // Error counters
+static volatile uint32_t    byte_count = 0;        // Bytes put on the bus
+static uint16_t             dma_min_count = DMA_MIN_COUNT; // Reads of at least this many bytes use DMA
+
 
 /**
  * @brief Initialize the I2C0 peripheral
@@ -36,78 +81,568 @@ void i2c_init() {
 	SIM->SCGC4 |= SIM_SCGC4_I2C0_MASK;
 	SIM->SCGC5 |= SIM_SCGC5_PORTE_MASK;
 	// Set pins to i2c function
-	PORTE->PCR[24] |= PORT_PCR_MUX(5);
-	PORTE->PCR[25] |= PORT_PCR_MUX(5);
+	PORTE->PCR[SCL_PIN] = PORT_PCR_MUX(5);
+	PORTE->PCR[SDA_PIN] = PORT_PCR_MUX(5);
 	// Set to 400k baud
 	// Baud = bus freq / (scl_div + mul)
 	// 24MHz/400kHz = 60; icr=0x11 sets scl_div to 56
 	I2C0->F = I2C_F_ICR(0x11) | I2C_F_MULT(0);
-	// Enable i2c and set to master mode
-	I2C0->C1 |= (I2C_C1_IICEN_MASK);
+	// Enable i2c and its interrupt
+	I2C0->C1 |= (I2C_C1_IICEN_MASK | I2C_C1_IICIE_MASK);
 	// Select high drive mode
 	I2C0->C2 |= (I2C_C2_HDRS_MASK);
+	// Clock DMA and route the I2C0 request to the receive channel
+	SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+	SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+	DMAMUX0->CHCFG[DMA_CHANNEL] = 0;
+	DMAMUX0->CHCFG[DMA_CHANNEL] = DMAMUX_CHCFG_SOURCE(DMA_SOURCE_I2C0) | DMAMUX_CHCFG_ENBL_MASK;
+	// Enable interrupts
+	NVIC_SetPriority(I2C0_IRQn, I2C_PRIORITY);
+	NVIC_ClearPendingIRQ(I2C0_IRQn);
+	NVIC_EnableIRQ(I2C0_IRQn);
+	NVIC_SetPriority(DMA0_IRQn, I2C_PRIORITY);
+	NVIC_ClearPendingIRQ(DMA0_IRQn);
+	NVIC_EnableIRQ(DMA0_IRQn);
 } // i2c_init()
 
 /**
- * @brief Write byte of data using i2c
- *
- * @param dev  - Device address to write to
- * @param reg  - Register address to write to
- * @param data - Byte of data to write
+ * @brief Start the transfer at the head of the queue. The rest of the
+ *        transfer is driven by I2C0_IRQHandler().
  *
  * @return none
  */
-void i2c_write_byte(uint8_t dev, uint8_t reg, uint8_t data) {
+static void start_transfer() {
+	byte_index = 0;
+	transfer_start = TIMER_Now();
+	// Device and register address, plus the device address again for a read
+	byte_count += queue[head].data_count + (queue[head].read ? 3 : 2);
+	state = I2C_STATE_DEV_W;
 	// Set to transmit mode
 	I2C_TRAN;
 	// Send start
 	I2C_M_START;
 	// Send device address (write)
-	I2C0->D = dev;
-	// Wait for ACK
-	I2C_WAIT
-	// Send register address
-	I2C0->D = reg;
-	I2C_WAIT
-	// Send data
-	I2C0->D = data;
-	I2C_WAIT
+	I2C0->D = queue[head].dev;
+} // start_transfer()
+
+/**
+ * @brief Hand the received bytes of a read over to DMA. Every byte but
+ *        the last two is moved into RAM without the CPU; each DMA read
+ *        of D starts reception of the next byte with an ACK. The last
+ *        DMA read starts the second to last byte, which is still ACKed,
+ *        so the byte interrupt can set NACK for the last byte in time.
+ *
+ * @param transfer - Pointer to the read transfer in progress
+ *
+ * @return none
+ */
+static void start_dma_receive(i2c_transfer_t *transfer) {
+	DMA0->DMA[DMA_CHANNEL].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA0->DMA[DMA_CHANNEL].SAR = (uint32_t)&I2C0->D;
+	DMA0->DMA[DMA_CHANNEL].DAR = (uint32_t)transfer->data;
+	DMA0->DMA[DMA_CHANNEL].DSR_BCR = DMA_DSR_BCR_BCR(transfer->data_count - DMA_TAIL_COUNT);
+	// Byte reads from D into an incrementing buffer, one per request,
+	// interrupt and drop the request once the count is reached
+	DMA0->DMA[DMA_CHANNEL].DCR = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK |
+	                             DMA_DCR_SSIZE(1) | DMA_DCR_DINC_MASK | DMA_DCR_DSIZE(1) |
+	                             DMA_DCR_D_REQ_MASK;
+	// DMA requests replace the byte interrupts until the last two bytes
+	I2C0->C1 = (I2C0->C1 & ~I2C_C1_IICIE_MASK) | I2C_C1_DMAEN_MASK;
+} // start_dma_receive()
+
+/**
+ * @brief Complete the transfer at the head of the queue, call its
+ *        callback, and start the next queued transfer
+ *
+ * @param status - Status of the transfer
+ *
+ * @return none
+ */
+static void finish_transfer(i2c_status_t status) {
+	i2c_transfer_t transfer = queue[head];
+
+	switch(status) {
+	case I2C_ERR_NAK:      error_counts.naks++;     break;
+	case I2C_ERR_ARB_LOST: error_counts.arb_lost++; break;
+	case I2C_ERR_TIMEOUT:  error_counts.timeouts++; break;
+	default:                                  break;
+	}
+
+	// Remove the transfer before the callback, so the callback can queue another one
+	head = (head + 1) % I2C_QUEUE_SIZE;
+	length--;
+	state = I2C_STATE_IDLE;
+
+	if(transfer.callback) {
+		transfer.callback(status, transfer.context);
+	}
+	// The callback may have already started a new transfer
+	if(state == I2C_STATE_IDLE && length > 0) {
+		start_transfer();
+	}
+} // finish_transfer()
+
+/**
+ * @brief End the transfer in progress early. Stops the DMA, releases the
+ *        bus, and completes the transfer with an error.
+ *
+ * @param status - Error that ended the transfer
+ *
+ * @return none
+ */
+static void abort_transfer(i2c_status_t status) {
+	// Stop the DMA and go back to byte interrupts
+	DMA0->DMA[DMA_CHANNEL].DCR = 0;
+	DMA0->DMA[DMA_CHANNEL].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	I2C0->C1 = (I2C0->C1 & ~(I2C_C1_DMAEN_MASK | I2C_C1_TXAK_MASK)) | I2C_C1_IICIE_MASK;
 	I2C_M_STOP;
+	// A stuck transfer may have left a slave holding SDA low
+	if(status == I2C_ERR_TIMEOUT) {
+		i2c_recover();
+	}
+	I2C0->S = I2C_S_IICIF_MASK | I2C_S_ARBL_MASK;
+	finish_transfer(status);
+} // abort_transfer()
+
+/**
+ * @brief Queue a transfer. The transfer is started right away if the
+ *        bus is idle, and otherwise once the transfers ahead of it have
+ *        completed. The data buffer must stay valid until the callback.
+ *        Can be called from the main context, interrupt handlers, and
+ *        transfer callbacks.
+ *
+ * @param transfer - Pointer to the transfer descriptor, which is copied
+ *
+ * @return True if the transfer was queued, false if the queue is full
+ *         or the transfer is empty
+ */
+bool i2c_submit(const i2c_transfer_t *transfer) {
+	uint32_t masking_state;
+
+	// Check for validity of transfer
+	if(!transfer || !transfer->data || transfer->data_count == 0) return false;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	if(length == I2C_QUEUE_SIZE) {
+		__set_PRIMASK(masking_state);
+		return false;
+	}
+	queue[(head + length) % I2C_QUEUE_SIZE] = *transfer;
+	length++;
+	if(state == I2C_STATE_IDLE) {
+		start_transfer();
+	}
+	__set_PRIMASK(masking_state);
+
+	return true;
+} // i2c_submit()
+
+/**
+ * @brief Check whether any transfer is queued or in progress
+ *
+ * @return True if the I2C0 transaction engine is busy
+ */
+bool i2c_busy() {
+	return (state != I2C_STATE_IDLE);
+} // i2c_busy()
+
+/**
+ * @brief I2C0 interrupt handler. Each time a byte has been transferred,
+ *        moves the transfer in progress on to its next step.
+ *
+ * @return none
+ */
+void I2C0_IRQHandler(void) {
+	i2c_transfer_t *transfer = &queue[head];
+	uint8_t status = I2C0->S;
+	uint8_t dummy;
+
+	// Clear the interrupt and arbitration lost flags
+	I2C0->S = I2C_S_IICIF_MASK | I2C_S_ARBL_MASK;
+
+	if(state == I2C_STATE_IDLE) return;
+	if(status & I2C_S_ARBL_MASK) {
+		abort_transfer(I2C_ERR_ARB_LOST);
+		return;
+	}
+	// Every byte sent must be acknowledged by the device
+	if((I2C0->C1 & I2C_C1_TX_MASK) && (status & I2C_S_RXAK_MASK)) {
+		abort_transfer(I2C_ERR_NAK);
+		return;
+	}
+
+	switch(state) {
+	case I2C_STATE_DEV_W:
+		// Send register address
+		I2C0->D = transfer->reg;
+		state = I2C_STATE_REG;
+		break;
+	case I2C_STATE_REG:
+		if(transfer->read) {
+			// Repeated start
+			I2C_M_RSTART;
+			// Send device address (read)
+			I2C0->D = (transfer->dev | 0x1);
+			state = I2C_STATE_DEV_R;
+		}
+		else {
+			// Send data
+			I2C0->D = transfer->data[byte_index++];
+			state = I2C_STATE_TX;
+		}
+		break;
+	case I2C_STATE_TX:
+		if(byte_index < transfer->data_count) {
+			// Send data
+			I2C0->D = transfer->data[byte_index++];
+		}
+		else {
+			I2C_M_STOP;
+			finish_transfer(I2C_OK);
+		}
+		break;
+	case I2C_STATE_DEV_R:
+		// Set to receive mode
+		I2C_REC;
+		if(transfer->data_count >= dma_min_count) {
+			ACK;
+			start_dma_receive(transfer);
+			// Dummy read starts reception of the first byte
+			dummy = I2C0->D;
+			(void)dummy;
+			state = I2C_STATE_RX_DMA;
+			break;
+		}
+		// ACK every byte except the last one of the burst
+		if(transfer->data_count == 1) NACK; else ACK;
+		// Dummy read starts reception of the first byte
+		dummy = I2C0->D;
+		(void)dummy;
+		state = I2C_STATE_RX;
+		break;
+	case I2C_STATE_RX:
+		if(byte_index == transfer->data_count - 1) {
+			// Send stop before reading the last byte, so no further byte is clocked in
+			I2C_M_STOP;
+			transfer->data[byte_index++] = I2C0->D;
+			finish_transfer(I2C_OK);
+		}
+		else {
+			// Reading D starts reception of the next byte, so NACK it if it is the last one
+			if(byte_index == transfer->data_count - 2) NACK; else ACK;
+			transfer->data[byte_index++] = I2C0->D;
+		}
+		break;
+	default:
+		break;
+	}
+} // I2C0_IRQHandler()
+
+/**
+ * @brief DMA channel 0 interrupt handler. Runs once every byte but the
+ *        last two of a DMA read has been moved into RAM, and hands the
+ *        read back to the byte interrupt. The bus holds SCL low after the
+ *        second to last byte until D is read, so a late interrupt only
+ *        stretches the clock, and the last byte is always NACKed by
+ *        I2C0_IRQHandler() as in a read without DMA.
+ *
+ * @return none
+ */
+void DMA0_IRQHandler(void) {
+	// Clear the done flag
+	DMA0->DMA[DMA_CHANNEL].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	if(state != I2C_STATE_RX_DMA) return;
+
+	byte_index = queue[head].data_count - DMA_TAIL_COUNT;
+	state = I2C_STATE_RX;
+	// Go back to byte interrupts, without the flags left by the DMA bytes
+	I2C0->C1 &= ~I2C_C1_DMAEN_MASK;
+	I2C0->S = I2C_S_IICIF_MASK;
+	I2C0->C1 |= I2C_C1_IICIE_MASK;
+	// The second to last byte may have arrived before the flag was cleared
+	if(I2C0->S & I2C_S_TCF_MASK) {
+		NVIC_SetPendingIRQ(I2C0_IRQn);
+	}
+} // DMA0_IRQHandler()
+
+/**
+ * @brief Check the transfer in progress against its deadline. A transfer
+ *        that has timed out is aborted, the bus is recovered, and the
+ *        transfer completes with I2C_ERR_TIMEOUT. Must be called
+ *        regularly from the main loop.
+ *
+ * @return none
+ */
+void i2c_poll() {
+	uint32_t masking_state;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	if(state != I2C_STATE_IDLE && (TIMER_Now() - transfer_start) > I2C_TIMEOUT_MS) {
+		abort_transfer(I2C_ERR_TIMEOUT);
+	}
+	__set_PRIMASK(masking_state);
+} // i2c_poll()
+
+/**
+ * @brief Wait for about a quarter of an SCL period at 100 kHz
+ *
+ * @return none
+ */
+static void recovery_delay() {
+	for(volatile uint32_t i = 0; i < RECOVERY_DELAY; i++) {}
+} // recovery_delay()
+
+/**
+ * @brief Free a bus held by a slave, by clocking SCL up to nine times
+ *        until SDA is released and then sending a STOP
+ *
+ * @return none
+ */
+void i2c_recover() {
+	// Disable i2c and drive its pins as open drain GPIO
+	I2C0->C1 &= ~I2C_C1_IICEN_MASK;
+	PTE->PCOR = (1 << SCL_PIN) | (1 << SDA_PIN);
+	LINE_RELEASE(SCL_PIN);
+	LINE_RELEASE(SDA_PIN);
+	PORTE->PCR[SCL_PIN] = PORT_PCR_MUX(1) | PORT_PCR_PE_MASK | PORT_PCR_PS_MASK;
+	PORTE->PCR[SDA_PIN] = PORT_PCR_MUX(1) | PORT_PCR_PE_MASK | PORT_PCR_PS_MASK;
+	recovery_delay();
+
+	// Clock SCL until the slave has shifted out its byte and released SDA
+	for(uint8_t i = 0; i < RECOVERY_PULSES && !(PTE->PDIR & (1 << SDA_PIN)); i++) {
+		LINE_LOW(SCL_PIN);
+		recovery_delay();
+		LINE_RELEASE(SCL_PIN);
+		recovery_delay();
+	}
+	// Send a STOP, SDA rising while SCL is high
+	LINE_LOW(SCL_PIN);
+	recovery_delay();
+	LINE_LOW(SDA_PIN);
+	recovery_delay();
+	LINE_RELEASE(SCL_PIN);
+	recovery_delay();
+	LINE_RELEASE(SDA_PIN);
+	recovery_delay();
+
+	// Give the pins back to i2c
+	PORTE->PCR[SCL_PIN] = PORT_PCR_MUX(5);
+	PORTE->PCR[SDA_PIN] = PORT_PCR_MUX(5);
+	I2C0->C1 |= I2C_C1_IICEN_MASK;
+	error_counts.recoveries++;
+} // i2c_recover()
+
+/**
+ * @brief Get the error counters
+ *
+ * @param errors - Pointer to where the error counters will be stored
+ *
+ * @return none
+ */
+void i2c_get_errors(i2c_errors_t *errors) {
+	uint32_t masking_state;
+
+	// Check for validity of errors
+	if(!errors) return;
+
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	*errors = error_counts;
+	__set_PRIMASK(masking_state);
+} // i2c_get_errors()
+
+/**
+ * @brief Get the number of bytes put on the bus since boot, including
+ *        device and register addresses
+ *
+ * @return Number of bytes
+ */
+uint32_t i2c_get_byte_count() {
+	return byte_count;
+} // i2c_get_byte_count()
+
+// Completion of a transfer started by the blocking functions
+typedef struct {
+	volatile bool         done;
+	volatile i2c_status_t status;
+} completion_t;
+
+/**
+ * @brief Transfer callback used by the blocking functions
+ *
+ * @param status  - Status of the transfer
+ * @param context - Pointer to the completion to set
+ *
+ * @return none
+ */
+static void set_done(i2c_status_t status, void *context) {
+	completion_t *completion = context;
+
+	completion->status = status;
+	completion->done = true;
+} // set_done()
+
+/**
+ * @brief Queue a transfer and wait for it to complete. Every transfer
+ *        ahead of it completes or times out within I2C_TIMEOUT_MS, so
+ *        the wait is bounded.
+ *
+ * @param transfer - Pointer to the transfer descriptor
+ *
+ * @return I2C_OK for success, otherwise the error that ended the transfer
+ */
+static i2c_status_t transfer_blocking(i2c_transfer_t *transfer) {
+	completion_t completion = { .done = false, .status = I2C_OK };
+	ticktime_t start = TIMER_Now();
+
+	transfer->callback = set_done;
+	transfer->context = &completion;
+	// Wait for room in the queue, then for the transfer to complete
+	while(!i2c_submit(transfer)) {
+		i2c_poll();
+		if((TIMER_Now() - start) > (I2C_QUEUE_SIZE * I2C_TIMEOUT_MS)) {
+			return I2C_ERR_QUEUE_FULL;
+		}
+	}
+	while(!completion.done) {
+		i2c_poll();
+	}
+
+	return completion.status;
+} // transfer_blocking()
+
+/**
+ * @brief Write byte of data using i2c. Blocks until the transfer has
+ *        completed or timed out, so it must not be called from an
+ *        interrupt handler.
+ *
+ * @param dev  - Device address to write to
+ * @param reg  - Register address to write to
+ * @param data - Byte of data to write
+ *
+ * @return I2C_OK for success, otherwise the error that ended the transfer
+ */
+i2c_status_t i2c_write_byte(uint8_t dev, uint8_t reg, uint8_t data) {
+	i2c_transfer_t transfer = {
+		.dev = dev, .reg = reg, .read = false, .data = &data, .data_count = 1
+	};
+
+	return transfer_blocking(&transfer);
 } // i2c_write_byte()
 
 /**
- * @brief Read bytes of data using i2c
+ * @brief Write bytes of data using i2c, starting at reg and relying on
+ *        the device to auto-increment the register address. Blocks until
+ *        the transfer has completed or timed out, so it must not be
+ *        called from an interrupt handler.
+ *
+ * @param dev        - Device address to write to
+ * @param reg        - First register address to write to
+ * @param data       - Pointer to the bytes of data to write
+ * @param data_count - Number of bytes to write
+ *
+ * @return I2C_OK for success, otherwise the error that ended the transfer
+ */
+i2c_status_t i2c_write_bytes(uint8_t dev, uint8_t reg, const uint8_t *data, uint16_t data_count) {
+	// The transfer only reads from data when writing
+	i2c_transfer_t transfer = {
+		.dev = dev, .reg = reg, .read = false, .data = (uint8_t *)data, .data_count = data_count
+	};
+
+	if(data_count == 0) return I2C_OK;
+	return transfer_blocking(&transfer);
+} // i2c_write_bytes()
+
+/**
+ * @brief Read bytes of data using i2c. Blocks until the transfer has
+ *        completed or timed out, so it must not be called from an
+ *        interrupt handler.
  *
  * @param dev        - Device address to read from
  * @param reg        - Register address to read from
  * @param data       - Pointer to where read data will be stored
  * @param data_count - Number of bytes to read
  *
- * @return The bytes of data that was read from i2c bus
+ * @return I2C_OK for success, otherwise the error that ended the transfer
  */
-void i2c_read_bytes(uint8_t dev, uint8_t reg, uint8_t * data, int8_t data_count) {
-	uint8_t dummy;
-	int8_t num_bytes_read = 0;
-	I2C_TRAN; // Set to transmit mode
-	I2C_M_START; // Send start
-	I2C0->D = dev; // Send dev address (write)
-	I2C_WAIT // Wait for completion
-	I2C0->D = reg; // Send register address
-	I2C_WAIT // Wait for completion
-	I2C_M_RSTART; // Repeated start
-	I2C0->D = (dev | 0x1); // Send device address (read)
-	I2C_WAIT // Wait for completion
-	I2C_REC; // Set to receive mode
-	ACK; // Set ACK after read
-	dummy = I2C0->D; // Dummy read
-	I2C_WAIT // Wait for completion
-	do {
-		ACK; // Set ACK after read
-		data[num_bytes_read++] = I2C0->D; // Read data
-		I2C_WAIT // Wait for completion
-	} while(num_bytes_read < data_count - 2);
-	NACK; // Set NACK after read
-	data[num_bytes_read++] = I2C0->D; // Read data
-	I2C_WAIT // Wait for completion
-	I2C_M_STOP; // Send stop
-} // i2c_read_byte()
+i2c_status_t i2c_read_bytes(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t data_count) {
+	i2c_transfer_t transfer = {
+		.dev = dev, .reg = reg, .read = true, .data = data, .data_count = data_count
+	};
+
+	if(data_count == 0) return I2C_OK;
+	return transfer_blocking(&transfer);
+} // i2c_read_bytes()
+
+/**
+ * @brief Count the loops the main context gets through while
+ *        BENCHMARK_RUNS copies of a read are on the bus, or, with no
+ *        read, until limit loops are done. Both run the same loop, so
+ *        the cycles not spent in it went to the I2C interrupts.
+ *
+ * @param transfer - Read to queue, or NULL to time limit idle loops
+ * @param limit    - Loops to run with no read
+ * @param loops    - Set to the number of loops run
+ *
+ * @return Time taken in SysTick counts
+ */
+static uint32_t benchmark_loops(const i2c_transfer_t *transfer, uint32_t limit, uint32_t *loops) {
+	volatile uint32_t count = 0;
+	uint32_t start, ticks = 0;
+
+	for(uint32_t run = 0; run < (transfer ? BENCHMARK_RUNS : 1); run++) {
+		start = TIMER_Ticks();
+		if(transfer && !i2c_submit(transfer)) break;
+		// Bitwise or, so every loop evaluates both sides
+		while((count < limit) | i2c_busy()) {
+			count++;
+		}
+		ticks += TIMER_Ticks() - start;
+	}
+	*loops = count;
+
+	return ticks;
+} // benchmark_loops()
+
+/**
+ * @brief Measure the CPU cycles one read takes with byte interrupts and
+ *        with DMA, against the time it takes on the bus, which is what a
+ *        polled read keeps the CPU busy for. The I2C interrupts are
+ *        timed by how much they slow down a loop in the main context.
+ *        Nothing else may use the bus meanwhile.
+ *
+ * @param dev        - Device address to read from
+ * @param reg        - Register address to read from
+ * @param data       - Pointer to where read data will be stored
+ * @param data_count - Number of bytes to read, at least DMA_MIN_COUNT
+ *
+ * @return none
+ */
+void i2c_benchmark(uint8_t dev, uint8_t reg, uint8_t *data, uint16_t data_count) {
+	i2c_transfer_t transfer = {
+		.dev = dev, .reg = reg, .read = true, .data = data, .data_count = data_count
+	};
+	uint64_t loop_cycles, bus_cycles[2], irq_cycles[2];
+	uint32_t ticks, loops;
+
+	// Check for validity of the read
+	if(!data || data_count < DMA_MIN_COUNT) return;
+
+	// Cost of one loop in cycles, scaled by BENCHMARK_LOOPS
+	ticks = benchmark_loops(NULL, BENCHMARK_LOOPS, &loops);
+	loop_cycles = (uint64_t)ticks * CYCLES_PER_TICK;
+	// Byte interrupts for every byte, then DMA
+	for(int path = 0; path < 2; path++) {
+		dma_min_count = (path == 0) ? UINT16_MAX : DMA_MIN_COUNT;
+		ticks = benchmark_loops(&transfer, 0, &loops);
+		bus_cycles[path] = (uint64_t)ticks * CYCLES_PER_TICK;
+		irq_cycles[path] = bus_cycles[path] - loops * loop_cycles / BENCHMARK_LOOPS;
+	}
+	dma_min_count = DMA_MIN_COUNT;
+
+	printf("i2c %u byte read: %lu cycles on the bus (all CPU when polled), %lu CPU cycles with byte interrupts, %lu with DMA\n\r",
+			(unsigned)data_count, (unsigned long)(bus_cycles[1] / BENCHMARK_RUNS),
+			(unsigned long)(irq_cycles[0] / BENCHMARK_RUNS), (unsigned long)(irq_cycles[1] / BENCHMARK_RUNS));
+} // i2c_benchmark()
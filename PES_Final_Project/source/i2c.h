@@ -16,6 +16,43 @@
 #define I2C_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define I2C_QUEUE_SIZE  4  // Number of transfers that can be queued, including the one in progress
+#define I2C_TIMEOUT_MS  10 // Longest time a transfer may take, a 192 byte read takes about 5 ms
+#define I2C_BAUD        400000 // SCL frequency in Hz
+
+// Transfer status
+typedef enum {
+	I2C_OK,             // Transfer completed
+	I2C_ERR_NAK,        // Device did not acknowledge a byte
+	I2C_ERR_ARB_LOST,   // Arbitration was lost
+	I2C_ERR_TIMEOUT,    // Transfer did not complete in time, the bus was recovered
+	I2C_ERR_QUEUE_FULL  // Transfer could not be queued in time
+} i2c_status_t;
+
+// I2C Error Counters
+typedef struct i2c_errors_s {
+	uint32_t naks;       // Transfers ended by a NAK
+	uint32_t arb_lost;   // Transfers ended by arbitration loss
+	uint32_t timeouts;   // Transfers ended by a timeout
+	uint32_t recoveries; // Bus recoveries
+} i2c_errors_t;
+
+// Called when a transfer has completed, from the I2C0 or DMA0 interrupt
+// or from i2c_poll()
+typedef void (*i2c_callback_t)(i2c_status_t status, void *context);
+
+// I2C Transfer Descriptor
+typedef struct i2c_transfer_s {
+	uint8_t        dev;        // Device address
+	uint8_t        reg;        // Register address
+	bool           read;       // True to read data from reg, false to write data to reg
+	uint8_t        *data;      // Data to write, or where read data will be stored
+	uint16_t       data_count; // Number of bytes to transfer
+	i2c_callback_t callback;   // Called once the transfer has completed, may be NULL
+	void           *context;   // Passed to callback
+} i2c_transfer_t;
 
 /**
  * @brief Initialize the I2C0 peripheral
@@ -25,26 +62,115 @@
 void i2c_init();
 
 /**
- * @brief Write byte of data using i2c
+ * @brief Queue a transfer. The transfer is started right away if the
+ *        bus is idle, and otherwise once the transfers ahead of it have
+ *        completed. The data buffer must stay valid until the callback.
+ *        Can be called from the main context, interrupt handlers, and
+ *        transfer callbacks.
+ *
+ * @param transfer - Pointer to the transfer descriptor, which is copied
+ *
+ * @return True if the transfer was queued, false if the queue is full
+ *         or the transfer is empty
+ */
+bool i2c_submit(const i2c_transfer_t *transfer);
+
+/**
+ * @brief Check whether any transfer is queued or in progress
+ *
+ * @return True if the I2C0 transaction engine is busy
+ */
+bool i2c_busy();
+
+/**
+ * @brief Check the transfer in progress against its deadline. A transfer
+ *        that has timed out is aborted, the bus is recovered, and the
+ *        transfer completes with I2C_ERR_TIMEOUT. Must be called
+ *        regularly from the main loop.
+ *
+ * @return none
+ */
+void i2c_poll();
+
+/**
+ * @brief Free a bus held by a slave, by clocking SCL up to nine times
+ *        until SDA is released and then sending a STOP
+ *
+ * @return none
+ */
+void i2c_recover();
+
+/**
+ * @brief Get the error counters
+ *
+ * @param errors - Pointer to where the error counters will be stored
+ *
+ * @return none
+ */
+void i2c_get_errors(i2c_errors_t *errors);
+
+/**
+ * @brief Get the number of bytes put on the bus since boot, including
+ *        device and register addresses
+ *
+ * @return Number of bytes
+ */
+uint32_t i2c_get_byte_count();
+
+/**
+ * @brief Write byte of data using i2c. Blocks until the transfer has
+ *        completed or timed out, so it must not be called from an
+ *        interrupt handler.
  *
  * @param dev  - Device address to write to
  * @param reg  - Register address to write to
  * @param data - Byte of data to write
  *
- * @return none
+ * @return I2C_OK for success, otherwise the error that ended the transfer
+ */
+i2c_status_t i2c_write_byte(uint8_t dev, uint8_t reg, uint8_t data);
+
+/**
+ * @brief Write bytes of data using i2c, starting at reg and relying on
+ *        the device to auto-increment the register address. Blocks until
+ *        the transfer has completed or timed out, so it must not be
+ *        called from an interrupt handler.
+ *
+ * @param dev        - Device address to write to
+ * @param reg        - First register address to write to
+ * @param data       - Pointer to the bytes of data to write
+ * @param data_count - Number of bytes to write
+ *
+ * @return I2C_OK for success, otherwise the error that ended the transfer
  */
-void i2c_write_byte(uint8_t dev, uint8_t reg, uint8_t data);
+i2c_status_t i2c_write_bytes(uint8_t dev, uint8_t reg, const uint8_t *data, uint16_t data_count);
 
 /**
- * @brief Read bytes of data using i2c
+ * @brief Read bytes of data using i2c. Blocks until the transfer has
+ *        completed or timed out, so it must not be called from an
+ *        interrupt handler.
  *
  * @param dev        - Device address to read from
  * @param reg        - Register address to read from
  * @param data       - Pointer to where read data will be stored
  * @param data_count - Number of bytes to read
  *
- * @return The bytes of data that was read from i2c bus
+ * @return I2C_OK for success, otherwise the error that ended the transfer
+ */
+i2c_status_t i2c_read_bytes(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t data_count);
+
+/**
+ * @brief Measure the CPU cycles one read takes with byte interrupts and
+ *        with DMA, against the time it takes on the bus, and print them.
+ *        Nothing else may use the bus meanwhile.
+ *
+ * @param dev        - Device address to read from
+ * @param reg        - Register address to read from
+ * @param data       - Pointer to where read data will be stored
+ * @param data_count - Number of bytes to read, at least 4
+ *
+ * @return none
  */
-void i2c_read_bytes(uint8_t dev, uint8_t reg, uint8_t * data, int8_t data_count);
+void i2c_benchmark(uint8_t dev, uint8_t reg, uint8_t *data, uint16_t data_count);
 
 #endif /* I2C_H_ */
@@ -0,0 +1,96 @@
+/**
+ * @file nvstore.c
+ * @brief Settings kept in flash
+ *
+ * This c file provides functionality for
+ * keeping the accelerometer calibration in the last
+ * flash sector across resets.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+#include "MKL25Z4.h"
+#include "fsl_flash.h"
+#include "nvstore.h"
+
+
+#define NVSTORE_MAGIC   0x43414C31 // "CAL1", marks a written record
+#define NVSTORE_SECTOR  (FSL_FEATURE_FLASH_PFLASH_BLOCK_SIZE - FSL_FEATURE_FLASH_PFLASH_BLOCK_SECTOR_SIZE) // Last 1KB sector, far above the program image
+
+static flash_config_t flash_config;        // Flash driver state
+static bool           flash_ready = false; // True once the flash driver is initialized
+
+
+/**
+ * @brief Calculate the checksum of a record
+ *
+ * @param record - Record to calculate the checksum of
+ *
+ * @return Value that makes the bytes of the record sum to zero
+ */
+static uint8_t record_checksum(const nvstore_t *record) {
+	const uint8_t *bytes = (const uint8_t *)record;
+	uint8_t sum = 0;
+
+	for(uint32_t i = 0; i < offsetof(nvstore_t, checksum); i++) {
+		sum += bytes[i];
+	}
+
+	return (uint8_t)-sum;
+} // record_checksum()
+
+/**
+ * @brief Read the settings record from flash
+ *
+ * @param record - Record to fill in
+ *
+ * @return True if a valid record was read, false if none has been saved
+ */
+bool nvstore_load(nvstore_t *record) {
+	// Flash is memory mapped, so it can be read directly
+	memcpy(record, (const void *)NVSTORE_SECTOR, sizeof(nvstore_t));
+
+	return (record->magic == NVSTORE_MAGIC) && (record->checksum == record_checksum(record));
+} // nvstore_load()
+
+/**
+ * @brief Write the settings record to flash, replacing the previous one.
+ *        Interrupts are off while the sector is erased and programmed,
+ *        which takes up to about 120 ms, so I2C transfers must be stopped
+ *        first with accelerometer_pause(). That outlasts the MMA8451Q
+ *        FIFO, so the samples of the write are lost.
+ *
+ * @param record - Record to write, the magic and checksum are filled in
+ *
+ * @return 0 for success, -1 if the flash could not be written
+ */
+int nvstore_save(nvstore_t *record) {
+	status_t status;
+	uint32_t masking_state;
+
+	if(!flash_ready) {
+		if(FLASH_Init(&flash_config) != kStatus_FLASH_Success) return -1;
+		// The flash command has to run from RAM while the flash is busy
+		if(FLASH_PrepareExecuteInRamFunctions(&flash_config) != kStatus_FLASH_Success) return -1;
+		flash_ready = true;
+	}
+
+	record->magic = NVSTORE_MAGIC;
+	record->checksum = record_checksum(record);
+
+	// Interrupt handlers run from flash, which can't be read while it is
+	// being erased or programmed
+	masking_state = __get_PRIMASK();
+	__disable_irq();
+	status = FLASH_Erase(&flash_config, NVSTORE_SECTOR, FSL_FEATURE_FLASH_PFLASH_BLOCK_SECTOR_SIZE, kFLASH_ApiEraseKey);
+	if(status == kStatus_FLASH_Success) {
+		status = FLASH_Program(&flash_config, NVSTORE_SECTOR, (uint32_t *)record, sizeof(nvstore_t));
+	}
+	__set_PRIMASK(masking_state);
+
+	return (status == kStatus_FLASH_Success) ? 0 : -1;
+} // nvstore_save()
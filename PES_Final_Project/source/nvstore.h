@@ -0,0 +1,48 @@
+/**
+ * @file nvstore.h
+ * @brief Settings kept in flash
+ *
+ * This h file provides functionality for
+ * keeping the accelerometer calibration in the last
+ * flash sector across resets.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#ifndef NVSTORE_H_
+#define NVSTORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Settings record, a multiple of 4 bytes so it can be programmed in longwords
+typedef struct nvstore_s {
+	uint32_t magic;      // NVSTORE_MAGIC when the record has been written
+	int8_t   offsets[3]; // MMA8451Q OFF_X, OFF_Y and OFF_Z in 2mg steps
+	uint8_t  checksum;   // Makes the bytes of the record sum to zero
+} nvstore_t;
+
+/**
+ * @brief Read the settings record from flash
+ *
+ * @param record - Record to fill in
+ *
+ * @return True if a valid record was read, false if none has been saved
+ */
+bool nvstore_load(nvstore_t *record);
+
+/**
+ * @brief Write the settings record to flash, replacing the previous one.
+ *        Interrupts are off while the sector is erased and programmed,
+ *        which takes up to about 120 ms, so I2C transfers must be stopped
+ *        first with accelerometer_pause().
+ *
+ * @param record - Record to write, the magic and checksum are filled in
+ *
+ * @return 0 for success, -1 if the flash could not be written
+ */
+int nvstore_save(nvstore_t *record);
+
+#endif /* NVSTORE_H_ */
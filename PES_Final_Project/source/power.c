@@ -0,0 +1,249 @@
+/**
+ * @file power.c
+ * @brief Low power mode selection
+ *
+ * This c file provides functionality for
+ * idling the MCU in the deepest power mode that the
+ * active peripherals allow, and measuring the idle time.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include <assert.h>
+#include "MKL25Z4.h"
+#include "fsl_smc.h"
+#include "power.h"
+#include "timers.h"
+#include "uart.h"
+#include "i2c.h"
+#include "accelerometer.h"
+
+
+static bool              low_power  = false; // True if the MCU may enter VLPS
+static volatile uint32_t sleep_time = 0;     // Time spent in VLPS since startup in ms
+static volatile uint32_t idle_time  = 0;     // Time spent in WAIT or VLPS since startup in ms
+static uint32_t          idle_ticks = 0;     // Idle time in SysTick counts not yet added to idle_time
+
+/**
+ * @brief Initialize low power modes. Allows VLPS and starts the LPTMR,
+ *        which times each stay in VLPS while SysTick is stopped.
+ *
+ * @return none
+ */
+void power_init() {
+	// VLPS must be allowed once after reset
+	SMC_SetPowerModeProtection(SMC, kSMC_AllowPowerModeVlp);
+	// Clock the LPTMR from the 1kHz LPO, which keeps running in VLPS
+	SIM->SCGC5 |= SIM_SCGC5_LPTMR_MASK;
+	LPTMR0->CSR = 0;
+	LPTMR0->PSR = LPTMR_PSR_PCS(1) | LPTMR_PSR_PBYP_MASK;
+	LPTMR0->CMR = POWER_MAX_SLEEP_MS - 1;
+	// Enable interrupts
+	NVIC_SetPriority(LPTMR0_IRQn, 3);
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn);
+	NVIC_EnableIRQ(LPTMR0_IRQn);
+} // power_init()
+
+/**
+ * @brief Choose the deepest power mode that is safe for the current state.
+ *        WAIT keeps every clock running, so UART0 at 38400 baud, the LED
+ *        PWM, SysTick, and I2C all work. VLPS stops the FLL, which clocks
+ *        UART0, the TPMs, SysTick, and I2C0, so it needs all of them idle
+ *        and a sleeping accelerometer. VLPR is never chosen: it limits the
+ *        bus clock to 1 MHz, which can't run I2C at 400 kHz for 800 Hz
+ *        samples, and while the accelerometer sleeps VLPS is lower still.
+ *
+ * @param cpu_work      - True if the main loop has work queued
+ * @param clocks_needed - True if a peripheral needs its clock running: a
+ *                        UART0 or I2C transfer in progress, the LED PWM, or
+ *                        SysTick timing a print interval or LED hold
+ * @param sensor_asleep - True if the accelerometer is in sleep mode
+ * @param low_power     - True if low power mode is enabled
+ *
+ * @return Power mode to enter
+ */
+power_mode_t power_select(bool cpu_work, bool clocks_needed, bool sensor_asleep, bool low_power) {
+	if(cpu_work) return POWER_RUN;
+	// Only an accelerometer with nothing to report lets the MCU stop its clocks
+	if(!low_power || clocks_needed || !sensor_asleep) return POWER_WAIT;
+	return POWER_VLPS;
+} // power_select()
+
+/**
+ * @brief Check whether the main loop has work queued
+ *
+ * @return True if a command character or samples are queued
+ */
+static bool cpu_work() {
+	return !cbfifo_empty(&uart_rx_cbfifo) ||
+		   !cbfifo_empty(&accel_cbfifo);
+} // cpu_work()
+
+/**
+ * @brief Check whether a peripheral has a transfer in progress that VLPS
+ *        would stop
+ *
+ * @return True if UART0 or I2C0 is busy
+ */
+static bool transfer_active() {
+	return !cbfifo_empty(&uart_tx_cbfifo) ||
+		   !(UART0->S1 & UART0_S1_TC_MASK) ||
+		   i2c_busy();
+} // transfer_active()
+
+/**
+ * @brief Enter VLPS until the next interrupt. Called with interrupts off.
+ *
+ * @return none
+ */
+static void enter_vlps() {
+	uint32_t elapsed;
+
+	// UART0 can't receive in VLPS, so an Rx edge wakes the MCU instead.
+	// The character that caused the edge is lost.
+	UART0->S2 |= UART0_S2_RXEDGIF_MASK;
+	UART0->BDH |= UART0_BDH_RXEDGIE_MASK;
+	// Time the stay with the LPTMR, which also bounds it
+	LPTMR0->CSR = LPTMR_CSR_TCF_MASK | LPTMR_CSR_TIE_MASK | LPTMR_CSR_TEN_MASK;
+
+	SMC_PreEnterStopModes();
+	SMC_SetPowerModeVlps(SMC);
+
+	// Back in run mode with the FLL relocked. The counter must be written
+	// before it can be read.
+	LPTMR0->CNR = 0;
+	elapsed = (LPTMR0->CSR & LPTMR_CSR_TCF_MASK) ? POWER_MAX_SLEEP_MS : LPTMR0->CNR;
+	LPTMR0->CSR = LPTMR_CSR_TCF_MASK;
+	UART0->BDH &= ~UART0_BDH_RXEDGIE_MASK;
+	sleep_time += elapsed;
+	idle_time += elapsed;
+	TIMER_Advance(elapsed);
+
+	// Let the wake up interrupt run
+	SMC_PostExitStopModes();
+} // enter_vlps()
+
+/**
+ * @brief Idle hook for the main loop. Waits for the next interrupt in the
+ *        mode chosen by power_select(), or returns at once if the main
+ *        loop has work queued. Time spent in VLPS is added to the timers.
+ *
+ * @param app_busy - True if the application needs the clocks running,
+ *                   for example to print or to time or light the LED
+ *
+ * @return Power mode the MCU was in
+ */
+power_mode_t power_idle(bool app_busy) {
+	power_mode_t mode;
+	uint32_t start;
+
+	// Decide with interrupts off, so nothing can arrive between the check
+	// and the WFI. A pending interrupt still ends the WFI, and runs once
+	// interrupts are back on.
+	__disable_irq();
+	mode = power_select(cpu_work(), app_busy || transfer_active(), accelerometer_asleep(), low_power);
+	switch(mode) {
+		case POWER_WAIT:
+			start = TIMER_Ticks();
+			SMC_SetPowerModeWait(SMC);
+			idle_ticks += TIMER_Ticks() - start;
+			idle_time += idle_ticks / TIMER_TICKS_PER_MS;
+			idle_ticks %= TIMER_TICKS_PER_MS;
+			break;
+		case POWER_VLPS:
+			enter_vlps();
+			break;
+		default:
+			break;
+	}
+	__enable_irq();
+
+	return mode;
+} // power_idle()
+
+/**
+ * @brief LPTMR0 interrupt handler. Only wakes the MCU after the longest
+ *        stay in VLPS.
+ *
+ * @return none
+ */
+void LPTMR0_IRQHandler(void) {
+	LPTMR0->CSR = LPTMR_CSR_TCF_MASK;
+} // LPTMR0_IRQHandler()
+
+/**
+ * @brief Enable or disable low power mode
+ *
+ * @param enable - True to let the MCU enter VLPS
+ *
+ * @return none
+ */
+void power_set_low_power(bool enable) {
+	low_power = enable;
+} // power_set_low_power()
+
+/**
+ * @brief Check whether low power mode is enabled
+ *
+ * @return True if the MCU may enter VLPS
+ */
+bool power_get_low_power() {
+	return low_power;
+} // power_get_low_power()
+
+/**
+ * @brief Get the time spent in VLPS since startup
+ *
+ * @return Time in VLPS in ms
+ */
+uint32_t power_get_sleep_time() {
+	return sleep_time;
+} // power_get_sleep_time()
+
+/**
+ * @brief Get the time spent idle in WAIT or VLPS since startup
+ *
+ * @return Idle time in ms
+ */
+uint32_t power_get_idle_time() {
+	return idle_time;
+} // power_get_idle_time()
+
+/**
+ * @brief Tests functionality of the power mode selection
+ *
+ * @return 0 for success.
+ */
+int power_test() {
+	// Queued work always keeps the MCU running
+	assert(power_select(true, false, true, true) == POWER_RUN);
+	assert(power_select(true, true, false, false) == POWER_RUN);
+
+	// With nothing queued the MCU at least waits
+	assert(power_select(false, true, false, false) == POWER_WAIT);
+	assert(power_select(false, false, true, false) == POWER_WAIT);
+
+	// An awake accelerometer or a peripheral in use keeps the clocks running
+	assert(power_select(false, false, false, true) == POWER_WAIT);
+	assert(power_select(false, true, true, true) == POWER_WAIT);
+
+	// Only an idle system with a sleeping accelerometer stops the MCU
+	assert(power_select(false, false, true, true) == POWER_VLPS);
+
+	// Walk a motion, idle, sleep, command, wake sequence through the policy
+	bool work_trace[]   = { true,  false, false, false, true,  false };
+	bool clocks_trace[] = { true,  true,  false, false, false, false };
+	bool asleep_trace[] = { false, false, true,  true,  true,  false };
+	power_mode_t expected[] = { POWER_RUN, POWER_WAIT, POWER_VLPS, POWER_VLPS, POWER_RUN, POWER_WAIT };
+	for(int i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		assert(power_select(work_trace[i], clocks_trace[i], asleep_trace[i], true) == expected[i]);
+	}
+
+	// power_idle() never enters VLPS with low power mode disabled
+	assert(!power_get_low_power());
+	assert(power_idle(false) != POWER_VLPS);
+
+	return 0;
+} // power_test()
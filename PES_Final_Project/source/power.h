@@ -0,0 +1,100 @@
+/**
+ * @file power.h
+ * @brief Low power mode selection
+ *
+ * This h file provides functionality for
+ * idling the MCU in the deepest power mode that the
+ * active peripherals allow, and measuring the idle time.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define POWER_MAX_SLEEP_MS (60000) // Longest stay in VLPS before the LPTMR wakes the MCU
+
+// Power Modes
+typedef enum {
+	POWER_RUN,  // The main loop has work queued, keep running
+	POWER_WAIT, // Wait for the next interrupt with all clocks running
+	POWER_VLPS  // Very low power stop, woken by UART0 Rx, the accelerometer pins, or the LPTMR
+} power_mode_t;
+
+/**
+ * @brief Initialize low power modes. Allows VLPS and starts the LPTMR,
+ *        which times each stay in VLPS while SysTick is stopped.
+ *
+ * @return none
+ */
+void power_init();
+
+/**
+ * @brief Choose the deepest power mode that is safe for the current state
+ *
+ * @param cpu_work      - True if the main loop has work queued
+ * @param clocks_needed - True if a peripheral needs its clock running: a
+ *                        UART0 or I2C transfer in progress, the LED PWM, or
+ *                        SysTick timing a print interval or LED hold
+ * @param sensor_asleep - True if the accelerometer is in sleep mode
+ * @param low_power     - True if low power mode is enabled
+ *
+ * @return Power mode to enter
+ */
+power_mode_t power_select(bool cpu_work, bool clocks_needed, bool sensor_asleep, bool low_power);
+
+/**
+ * @brief Idle hook for the main loop. Waits for the next interrupt in the
+ *        mode chosen by power_select(), or returns at once if the main
+ *        loop has work queued. Time spent in VLPS is added to the timers.
+ *
+ * @param app_busy - True if the application needs the clocks running,
+ *                   for example to print or to time or light the LED
+ *
+ * @return Power mode the MCU was in
+ */
+power_mode_t power_idle(bool app_busy);
+
+/**
+ * @brief Enable or disable low power mode
+ *
+ * @param enable - True to let the MCU enter VLPS
+ *
+ * @return none
+ */
+void power_set_low_power(bool enable);
+
+/**
+ * @brief Check whether low power mode is enabled
+ *
+ * @return True if the MCU may enter VLPS
+ */
+bool power_get_low_power();
+
+/**
+ * @brief Get the time spent in VLPS since startup
+ *
+ * @return Time in VLPS in ms
+ */
+uint32_t power_get_sleep_time();
+
+/**
+ * @brief Get the time spent idle in WAIT or VLPS since startup
+ *
+ * @return Idle time in ms
+ */
+uint32_t power_get_idle_time();
+
+/**
+ * @brief Tests functionality of the power mode selection
+ *
+ * @return 0 for success.
+ */
+int power_test();
+
+#endif /* POWER_H_ */
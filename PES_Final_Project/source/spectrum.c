@@ -0,0 +1,280 @@
+/**
+ * @file spectrum.c
+ * @brief Vibration spectrum of the acceleration stream
+ *
+ * This c file provides functionality for
+ * collecting blocks of accelerometer samples and
+ * reporting their spectrum peaks and band energies.
+ *
+ * Blocks are double buffered: samples keep being collected
+ * into one buffer while the other is transformed. The
+ * transform is a radix-2 complex FFT in Q15 that halves the
+ * data at every stage, as arm_cfft_q15() does, so the output
+ * is scaled by 1/N and cannot overflow. The CMSIS-DSP library
+ * is not part of the project so the transform is built here.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ * @references CMSIS-DSP arm_cfft_q15
+ *
+ */
+#include <math.h>
+#include "spectrum.h"
+#include "uart.h"
+
+
+#define QUARTER_WAVE  (SPECTRUM_MAX_SIZE / 4) // Sine table entries for 0 to pi/2
+
+static bool            active      = false;           // True while blocks are collected
+static uint16_t        block_size  = SPECTRUM_MIN_SIZE; // Samples per block
+static spectrum_axis_t block_axis  = SPECTRUM_AXIS_Z; // Axis samples are collected from
+static uint8_t         acq_block   = 0;               // Buffer samples are collected into
+static uint16_t        acq_count   = 0;               // Samples collected into acq_block
+static int8_t          ready_block = -1;              // Buffer waiting to be transformed, -1 if none
+static uint16_t        acq_odr     = ACCEL_ODR_HZ;    // ODR of the samples being collected in Hz
+static uint16_t        block_odr[2];                  // ODR each buffer was collected at in Hz
+
+static int16_t blocks[2][SPECTRUM_MAX_SIZE];     // Double buffered sample blocks
+static int16_t fft_data[2 * SPECTRUM_MAX_SIZE];  // Interleaved real and imaginary FFT data
+static int16_t sine_table[QUARTER_WAVE + 1];     // sin(2*pi*k/SPECTRUM_MAX_SIZE) in Q15
+static bool    sine_table_valid = false;
+
+
+/**
+ * @brief Look up sin(2*pi*k/SPECTRUM_MAX_SIZE) in Q15
+ *
+ * @param k - Twiddle index from 0 to SPECTRUM_MAX_SIZE / 2
+ *
+ * @return Sine in Q15
+ */
+static int16_t sine(uint16_t k) {
+	return (k <= QUARTER_WAVE) ? sine_table[k] : sine_table[2 * QUARTER_WAVE - k];
+} // sine()
+
+/**
+ * @brief Look up cos(2*pi*k/SPECTRUM_MAX_SIZE) in Q15
+ *
+ * @param k - Twiddle index from 0 to SPECTRUM_MAX_SIZE / 2
+ *
+ * @return Cosine in Q15
+ */
+static int16_t cosine(uint16_t k) {
+	return (k <= QUARTER_WAVE) ? sine_table[QUARTER_WAVE - k] : -sine_table[k - QUARTER_WAVE];
+} // cosine()
+
+/**
+ * @brief In place radix-2 decimation in time FFT of Q15 complex data.
+ *        Every stage halves the data, so the output is scaled by 1/n.
+ *
+ * @param data - n interleaved real and imaginary values
+ * @param n    - Number of points, a power of two up to SPECTRUM_MAX_SIZE
+ *
+ * @return none
+ */
+static void fft_q15(int16_t *data, uint16_t n) {
+	int16_t tmp;
+
+	// Bit reversal permutation
+	for(uint16_t i = 1, j = 0; i < n; i++) {
+		uint16_t bit = n >> 1;
+		for(; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if(i < j) {
+			tmp = data[2 * i];     data[2 * i] = data[2 * j];         data[2 * j] = tmp;
+			tmp = data[2 * i + 1]; data[2 * i + 1] = data[2 * j + 1]; data[2 * j + 1] = tmp;
+		}
+	}
+
+	// Butterflies
+	for(uint16_t half = 1; half < n; half <<= 1) {
+		uint16_t step = SPECTRUM_MAX_SIZE / (2 * half); // Twiddle index step for this stage
+		for(uint16_t k = 0; k < half; k++) {
+			int32_t wr = cosine(k * step);
+			int32_t wi = sine(k * step);
+			for(uint16_t i = k; i < n; i += 2 * half) {
+				uint16_t j = i + half;
+				// t = x[j] * e^(-i*2*pi*k/(2*half))
+				int32_t tr = (data[2 * j] * wr + data[2 * j + 1] * wi) >> 15;
+				int32_t ti = (data[2 * j + 1] * wr - data[2 * j] * wi) >> 15;
+				int32_t ur = data[2 * i];
+				int32_t ui = data[2 * i + 1];
+				data[2 * i]     = (ur + tr) >> 1;
+				data[2 * i + 1] = (ui + ti) >> 1;
+				data[2 * j]     = (ur - tr) >> 1;
+				data[2 * j + 1] = (ui - ti) >> 1;
+			}
+		}
+	}
+} // fft_q15()
+
+/**
+ * @brief Get the power of an FFT bin
+ *
+ * @param k - Bin index
+ *
+ * @return Power of the bin in counts^2
+ */
+static uint32_t bin_power(uint16_t k) {
+	int32_t re = fft_data[2 * k];
+	int32_t im = fft_data[2 * k + 1];
+	return (uint32_t)(re * re + im * im);
+} // bin_power()
+
+/**
+ * @brief Start collecting blocks of samples and reporting their spectrum
+ *
+ * @param size - Block size in samples, a power of two from
+ *               SPECTRUM_MIN_SIZE to SPECTRUM_MAX_SIZE
+ * @param axis - Axis to collect samples from
+ *
+ * @return 0 for success, -1 for an invalid block size
+ */
+int spectrum_start(uint16_t size, spectrum_axis_t axis) {
+	if(size < SPECTRUM_MIN_SIZE || size > SPECTRUM_MAX_SIZE) return -1;
+	if(size & (size - 1)) return -1;
+
+	// Build the sine table once
+	if(!sine_table_valid) {
+		for(uint16_t k = 0; k <= QUARTER_WAVE; k++) {
+			float value = sinf((2.0f * 3.14159265f * k) / SPECTRUM_MAX_SIZE) * 32768.0f;
+			sine_table[k] = (value >= 32767.0f) ? 32767 : (int16_t)lroundf(value);
+		}
+		sine_table_valid = true;
+	}
+
+	block_size = size;
+	block_axis = axis;
+	acq_block = 0;
+	acq_count = 0;
+	ready_block = -1;
+	active = true;
+
+	return 0;
+} // spectrum_start()
+
+/**
+ * @brief Stop collecting blocks of samples
+ *
+ * @return none
+ */
+void spectrum_stop() {
+	active = false;
+} // spectrum_stop()
+
+/**
+ * @brief Check if spectrum blocks are being collected
+ *
+ * @return True if collecting, false otherwise
+ */
+bool spectrum_active() {
+	return active;
+} // spectrum_active()
+
+/**
+ * @brief Set the ODR of the samples that follow. A block is only ever
+ *        collected at one ODR, so the block being collected restarts on
+ *        a change, and its frequencies are reported at its own ODR.
+ *
+ * @param odr - ODR in Hz
+ *
+ * @return none
+ */
+void spectrum_set_odr(uint16_t odr) {
+	if(odr == acq_odr) return;
+
+	acq_count = 0;
+	acq_odr = odr;
+} // spectrum_set_odr()
+
+/**
+ * @brief Add samples to the block being collected. Once the block is
+ *        full it is handed to spectrum_process() and collection
+ *        continues in the other buffer.
+ *
+ * @param samples     - Samples to add
+ * @param num_samples - Number of samples
+ *
+ * @return none
+ */
+void spectrum_add_samples(const accel_sample_t *samples, uint32_t num_samples) {
+	if(!active) return;
+
+	for(uint32_t i = 0; i < num_samples; i++) {
+		blocks[acq_block][acq_count++] = (block_axis == SPECTRUM_AXIS_X) ? samples[i].x :
+		                                 (block_axis == SPECTRUM_AXIS_Y) ? samples[i].y : samples[i].z;
+		// Hand over the full block and keep collecting into the other buffer
+		if(acq_count == block_size) {
+			block_odr[acq_block] = acq_odr;
+			ready_block = acq_block;
+			acq_block ^= 1;
+			acq_count = 0;
+		}
+	}
+} // spectrum_add_samples()
+
+/**
+ * @brief Transform the last completed block, if any, and print its peak
+ *        frequencies and band energies
+ *
+ * @return none
+ */
+void spectrum_process() {
+	uint16_t peak_bins[SPECTRUM_NUM_PEAKS] = { 0 };
+	uint32_t peak_powers[SPECTRUM_NUM_PEAKS] = { 0 };
+	uint32_t band_energies[SPECTRUM_NUM_BANDS] = { 0 };
+	uint16_t num_bins = block_size / 2;
+	int16_t *block;
+	int32_t mean = 0, value;
+	uint16_t odr;
+
+	if(!active || ready_block < 0) return;
+	block = blocks[ready_block];
+	odr = block_odr[ready_block];
+	ready_block = -1;
+
+	// Remove the mean (gravity and offset) so it does not mask the low bins
+	for(uint16_t i = 0; i < block_size; i++) {
+		mean += block[i];
+	}
+	mean /= block_size;
+	for(uint16_t i = 0; i < block_size; i++) {
+		value = block[i] - mean;
+		fft_data[2 * i] = (value > INT16_MAX / 2) ? INT16_MAX / 2 : (value < -INT16_MAX / 2) ? -INT16_MAX / 2 : value;
+		fft_data[2 * i + 1] = 0;
+	}
+
+	fft_q15(fft_data, block_size);
+
+	for(uint16_t k = 1; k < num_bins; k++) {
+		uint32_t power = bin_power(k);
+		// Accumulate band energy
+		band_energies[(k * SPECTRUM_NUM_BANDS) / num_bins] += power;
+		// Keep the largest local maxima, sorted in descending order
+		if(power == 0 || power < bin_power(k - 1) || power < bin_power(k + 1)) continue;
+		for(uint8_t p = 0; p < SPECTRUM_NUM_PEAKS; p++) {
+			if(power > peak_powers[p]) {
+				for(uint8_t q = SPECTRUM_NUM_PEAKS - 1; q > p; q--) {
+					peak_powers[q] = peak_powers[q - 1];
+					peak_bins[q] = peak_bins[q - 1];
+				}
+				peak_powers[p] = power;
+				peak_bins[p] = k;
+				break;
+			}
+		}
+	}
+
+	uart_printf("peaks:");
+	for(uint8_t p = 0; p < SPECTRUM_NUM_PEAKS && peak_powers[p] > 0; p++) {
+		uart_printf(" %.1f Hz (%lu)", ((float)peak_bins[p] * odr) / block_size, (unsigned long)peak_powers[p]);
+	}
+	uart_printf("\n\r");
+	uart_printf("bands:");
+	for(uint8_t b = 0; b < SPECTRUM_NUM_BANDS; b++) {
+		uart_printf(" %lu", (unsigned long)band_energies[b]);
+	}
+	uart_printf("\n\r");
+} // spectrum_process()
@@ -0,0 +1,90 @@
+/**
+ * @file spectrum.h
+ * @brief Vibration spectrum of the acceleration stream
+ *
+ * This h file provides functionality for
+ * collecting blocks of accelerometer samples and
+ * reporting their spectrum peaks and band energies.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ * @references CMSIS-DSP arm_cfft_q15
+ *
+ */
+#ifndef SPECTRUM_H_
+#define SPECTRUM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accelerometer.h"
+
+#define SPECTRUM_MIN_SIZE   128 // Smallest block size in samples
+#define SPECTRUM_MAX_SIZE   512 // Largest block size in samples
+#define SPECTRUM_NUM_PEAKS  3   // Number of peak frequencies reported per block
+#define SPECTRUM_NUM_BANDS  8   // Number of equal width bands from 0 Hz to ODR/2
+
+// Axes the spectrum can be collected from
+typedef enum spectrum_axis_e {
+	SPECTRUM_AXIS_X,
+	SPECTRUM_AXIS_Y,
+	SPECTRUM_AXIS_Z
+} spectrum_axis_t;
+
+/**
+ * @brief Start collecting blocks of samples and reporting their spectrum
+ *
+ * @param size - Block size in samples, a power of two from
+ *               SPECTRUM_MIN_SIZE to SPECTRUM_MAX_SIZE
+ * @param axis - Axis to collect samples from
+ *
+ * @return 0 for success, -1 for an invalid block size
+ */
+int spectrum_start(uint16_t size, spectrum_axis_t axis);
+
+/**
+ * @brief Stop collecting blocks of samples
+ *
+ * @return none
+ */
+void spectrum_stop();
+
+/**
+ * @brief Check if spectrum blocks are being collected
+ *
+ * @return True if collecting, false otherwise
+ */
+bool spectrum_active();
+
+/**
+ * @brief Set the ODR of the samples that follow. A block is only ever
+ *        collected at one ODR, so the block being collected restarts on
+ *        a change, and its frequencies are reported at its own ODR.
+ *
+ * @param odr - ODR in Hz
+ *
+ * @return none
+ */
+void spectrum_set_odr(uint16_t odr);
+
+/**
+ * @brief Add samples to the block being collected. Once the block is
+ *        full it is handed to spectrum_process() and collection
+ *        continues in the other buffer.
+ *
+ * @param samples     - Samples to add
+ * @param num_samples - Number of samples
+ *
+ * @return none
+ */
+void spectrum_add_samples(const accel_sample_t *samples, uint32_t num_samples);
+
+/**
+ * @brief Transform the last completed block, if any, and print its peak
+ *        frequencies and band energies
+ *
+ * @return none
+ */
+void spectrum_process();
+
+#endif /* SPECTRUM_H_ */
@@ -0,0 +1,114 @@
+/**
+ * @file stats.c
+ * @brief Streaming statistics of the acceleration stream
+ *
+ * This c file provides functionality for
+ * accumulating statistics of the linear acceleration
+ * over an interval, one sample at a time.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#include "accelerometer.h"
+#include "detector.h"
+#include "uart.h"
+#include "stats.h"
+
+
+/**
+ * @brief Integer square root
+ *
+ * @param value - Value to take the square root of
+ *
+ * @return Largest integer whose square is less than or equal to value
+ */
+static uint32_t isqrt(uint32_t value) {
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while(bit > value) {
+		bit >>= 2;
+	}
+	while(bit) {
+		if(value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+} // isqrt()
+
+/**
+ * @brief Start a new interval. The threshold state is kept so a crossing
+ *        spanning two intervals is counted once.
+ *
+ * @param stats - Pointer to statistics data structure
+ *
+ * @return none
+ */
+void stats_reset(stats_t *stats) {
+	if(!stats) return;
+
+	stats->count = 0;
+	stats->periods = 0;
+	stats->min_sq = UINT32_MAX;
+	stats->max_sq = 0;
+	stats->sum = 0;
+	stats->sum_sq = 0;
+	stats->crossings = 0;
+} // stats_reset()
+
+/**
+ * @brief Add one sample to the statistics. The mean and rms are weighted
+ *        by the time each sample stands for, so samples at a lower ODR
+ *        count for as long as they last.
+ *
+ * @param stats        - Pointer to statistics data structure
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ * @param above        - True if the sample is at or above the target
+ * @param step         - Samples at ACCEL_ODR_HZ the sample stands for
+ *
+ * @return none
+ */
+void stats_update(stats_t *stats, uint32_t magnitude_sq, bool above, uint32_t step) {
+	stats->count++;
+	stats->periods += step;
+	if(magnitude_sq < stats->min_sq) stats->min_sq = magnitude_sq;
+	if(magnitude_sq > stats->max_sq) stats->max_sq = magnitude_sq;
+	stats->sum += isqrt(magnitude_sq) * step;
+	stats->sum_sq += (uint64_t)magnitude_sq * step;
+	if(above && !stats->above) stats->crossings++;
+	stats->above = above;
+} // stats_update()
+
+/**
+ * @brief Print the statistics of the interval in m/s^2
+ *
+ * @param stats - Pointer to statistics data structure
+ *
+ * @return none
+ */
+void stats_print(const stats_t *stats) {
+	uint32_t mean;
+
+	if(stats->count == 0) {
+		uart_printf("no samples\n\r");
+		return;
+	}
+
+	mean = stats->sum / stats->periods;
+	uart_printf("n=%lu min=%.2f max=%.2f mean=%.2f rms=%.2f m/s^2 crossings=%lu\n\r",
+			(unsigned long)stats->count,
+			acceleration_mps2(stats->min_sq),
+			acceleration_mps2(stats->max_sq),
+			acceleration_mps2(mean * mean),
+			acceleration_mps2((uint32_t)(stats->sum_sq / stats->periods)),
+			(unsigned long)stats->crossings);
+} // stats_print()
@@ -0,0 +1,65 @@
+/**
+ * @file stats.h
+ * @brief Streaming statistics of the acceleration stream
+ *
+ * This h file provides functionality for
+ * accumulating statistics of the linear acceleration
+ * over an interval, one sample at a time.
+ *
+ * @author Maurice Takeda
+ * @date November 3, 2022
+ * @version 1.0
+ *
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Statistics accumulated over one interval
+typedef struct stats_s {
+	uint32_t count;      // Number of samples
+	uint32_t periods;    // Sample periods at ACCEL_ODR_HZ covered by the samples
+	uint32_t min_sq;     // Smallest squared magnitude in counts^2
+	uint32_t max_sq;     // Largest squared magnitude in counts^2
+	uint32_t sum;        // Sum of magnitudes in counts, weighted by step
+	uint64_t sum_sq;     // Sum of squared magnitudes in counts^2, weighted by step
+	uint32_t crossings;  // Number of times the magnitude rose to the target
+	bool     above;      // True if the last sample was at or above the target
+} stats_t;
+
+/**
+ * @brief Start a new interval. The threshold state is kept so a crossing
+ *        spanning two intervals is counted once.
+ *
+ * @param stats - Pointer to statistics data structure
+ *
+ * @return none
+ */
+void stats_reset(stats_t *stats);
+
+/**
+ * @brief Add one sample to the statistics. The mean and rms are weighted
+ *        by the time each sample stands for, so samples at a lower ODR
+ *        count for as long as they last.
+ *
+ * @param stats        - Pointer to statistics data structure
+ * @param magnitude_sq - Squared linear acceleration in counts^2
+ * @param above        - True if the sample is at or above the target
+ * @param step         - Samples at ACCEL_ODR_HZ the sample stands for
+ *
+ * @return none
+ */
+void stats_update(stats_t *stats, uint32_t magnitude_sq, bool above, uint32_t step);
+
+/**
+ * @brief Print the statistics of the interval in m/s^2
+ *
+ * @param stats - Pointer to statistics data structure
+ *
+ * @return none
+ */
+void stats_print(const stats_t *stats);
+
+#endif /* STATS_H_ */
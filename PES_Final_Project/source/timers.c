@@ -24,7 +24,7 @@ static ticktime_t time_poll       = 0; // Time since last touch sense polling in
  */
 void TIMER_Init()
 {
-	SysTick->LOAD = 3000 - 1; // Set reload to get 1ms interrupts
+	SysTick->LOAD = TIMER_TICKS_PER_MS - 1; // Set reload to get 1ms interrupts
 	NVIC_SetPriority(SysTick_IRQn, 3);
 	SysTick->VAL = 0;
 	SysTick->CTRL = SysTick_CTRL_TICKINT_Msk | // Enable interrupts
@@ -42,6 +42,28 @@ ticktime_t TIMER_Now()
 } // TIMER_Now()
 
 
+/*
+ * @brief Get time since startup in SysTick counts, for timing intervals
+ *        shorter than a ms. Wraps after about 23 minutes.
+ * @return Time since startup in SysTick counts
+ */
+uint32_t TIMER_Ticks()
+{
+	uint32_t ms, count;
+	uint32_t masking_state = __get_PRIMASK();
+	__disable_irq();
+	ms = time_now;
+	count = SysTick->VAL;
+	// The counter reloaded but SysTick_Handler() hasn't counted it yet
+	if(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		ms++;
+		count = SysTick->VAL;
+	}
+	__set_PRIMASK(masking_state);
+	// The counter counts down from the reload value
+	return ms * TIMER_TICKS_PER_MS + (TIMER_TICKS_PER_MS - 1 - count);
+} // TIMER_Ticks()
+
 /*
  * @brief Reset timer to 0; doesn't affect TIMER_Now() values
  * @return none
@@ -77,6 +99,22 @@ bool TIMER_Poll(uint32_t period)
 	return false;
 } // TIMER_Poll()
 
+/*
+ * @brief Add time that passed while SysTick was stopped, such as in a
+ *        low power stop mode
+ * @param ms - Time to add in ms
+ * @return none
+ */
+void TIMER_Advance(uint32_t ms)
+{
+	uint32_t masking_state = __get_PRIMASK();
+	__disable_irq();
+	time_get += ms;
+	time_now += ms;
+	time_poll += ms;
+	__set_PRIMASK(masking_state);
+} // TIMER_Advance()
+
 /*
  * @brief SysTick Interrupt Handler
  * @return none
@@ -19,6 +19,8 @@
 
 typedef uint32_t ticktime_t; // Time, in thousandths of a second
 
+#define TIMER_TICKS_PER_MS (3000) // SysTick counts per ms
+
 /*
  * @brief Initialize the timing system
  * @return none
@@ -31,6 +33,13 @@ void       TIMER_Init();
  */
 ticktime_t TIMER_Now();
 
+/*
+ * @brief Get time since startup in SysTick counts, for timing intervals
+ *        shorter than a ms. Wraps after about 23 minutes.
+ * @return Time since startup in SysTick counts
+ */
+uint32_t   TIMER_Ticks();
+
 /*
  * @brief Reset timer to 0; doesn't affect TIMER_Now() values
  * @return none
@@ -52,6 +61,14 @@ ticktime_t TIMER_Get();
  */
 bool       TIMER_Poll(uint32_t period);
 
+/*
+ * @brief Add time that passed while SysTick was stopped, such as in a
+ *        low power stop mode
+ * @param ms - Time to add in ms
+ * @return none
+ */
+void       TIMER_Advance(uint32_t ms);
+
 /*
  * @brief SysTick Interrupt Handler
  * @return none
@@ -13,6 +13,8 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
 #include "MKL25Z4.h"
 #include "uart.h"
 
@@ -22,13 +24,35 @@
 #define UART_OVERSAMPLE_RATE   (16)
 #define UART_TWO_STOP_BITS     (1)
 #define UART_PARITY_NONE       (0)
+#define UART_TX_QUEUE_LENGTH   (256) // Tx queue capacity in characters, longer than any printed line
+#define UART_RX_QUEUE_LENGTH   (64)  // Rx queue capacity in characters, drained on every pass of the main loop
+#define UART_LINE_LENGTH       (128) // Longest line written without interleaving, and uart_printf() space claimed in the Tx queue
+#define UART_PAD               ('\0') // Fills claimed Tx space that couldn't be given back, never sent
 
-cbfifo_t uart_tx_cbfifo;
-cbfifo_t uart_rx_cbfifo;
+CBFIFO_DEFINE(uart_tx_cbfifo, char, UART_TX_QUEUE_LENGTH);
+CBFIFO_DEFINE(uart_rx_cbfifo, char, UART_RX_QUEUE_LENGTH);
 
 
 /**
- * @brief Writes the specified bytes to serial output
+ * @brief Starts the transmitter if it isn't already running. Safe to call
+ *        from any interrupt priority.
+ *
+ * @return none
+ */
+static void start_tx() {
+	uint32_t masking_state = __get_PRIMASK();
+	__disable_irq();
+	if(!(UART0->C2 & UART0_C2_TIE_MASK)) {
+	  UART0->C2 |= UART0_C2_TIE(1);
+	}
+	__set_PRIMASK(masking_state);
+} // start_tx()
+
+/**
+ * @brief Writes the specified bytes to serial output. Pieces of up to
+ *        UART_LINE_LENGTH bytes are never interleaved with other writers.
+ *        An interrupt handler can't wait for the transmitter, so a handler
+ *        that finds the Tx circular buffer full drops the rest.
  *
  * @param handle - unused
  * @param buf    - pointer to character array to write
@@ -37,26 +61,83 @@ cbfifo_t uart_rx_cbfifo;
  * @return 0 for success, -1 for failure
  */
 int __sys_write(int handle, char *buf, int size) {
+	size_t count;
+
 	// Check for validity of character buffer
 	if(!buf) return -1;
 
-	// Wait until there is enough space in the Tx circular buffer to transmit
-	// the character buffer
-	while((CAPACITY - cbfifo_length(&uart_tx_cbfifo)) < size)
-		;
-
-	// Enqueue the character buffer to the Tx circular buffer.
-	// Return -1 if the operation fails
-	if(cbfifo_enqueue(&uart_tx_cbfifo, buf, size) != size) return -1;
-
-	// Start transmitter if it isn't already running
-	if(!(UART0->C2 & UART0_C2_TIE_MASK)) {
-	  UART0->C2 |= UART0_C2_TIE(1);
+	// Enqueue whole pieces, waiting for the transmitter to free space, so a
+	// buffer longer than the Tx circular buffer still goes out
+	while(size > 0) {
+		count = (size < UART_LINE_LENGTH) ? size : UART_LINE_LENGTH;
+		if(cbfifo_enqueue_mp(&uart_tx_cbfifo, buf, count) == count) {
+			buf += count;
+			size -= count;
+			start_tx();
+		}
+		else if(__get_IPSR() != 0) {
+			// error - queue full in an interrupt handler.
+			// discard the rest
+			return -1;
+		}
 	}
 
 	return 0;
 } // __sys_write()
 
+/**
+ * @brief Formats a line straight into the Tx circular buffer, saving the
+ *        copy __sys_write() makes from the printf() buffer. The unused end
+ *        of the claimed space is given back, or padded with UART_PAD if
+ *        an interrupt handler claimed space after it meanwhile. If the line
+ *        doesn't fit in the contiguous free space, it is formatted in a
+ *        line buffer and written with __sys_write() instead. Safe to call
+ *        from any interrupt priority, lines are never interleaved.
+ *
+ * @param format - printf() format string
+ * @param ...    - Values to format
+ *
+ * @return Number of characters written, -1 for failure
+ */
+int uart_printf(const char *format, ...) {
+	char line[UART_LINE_LENGTH];
+	va_list args;
+	char *space;
+	uint32_t start;
+	size_t claimed, used = 0;
+	int length;
+
+	// Try to format in place, the terminating null isn't kept
+	claimed = cbfifo_claim(&uart_tx_cbfifo, UART_LINE_LENGTH, &start, (void**)&space);
+	va_start(args, format);
+	length = vsnprintf(space, claimed, format, args);
+	va_end(args);
+	if(length >= 0 && (size_t)length < claimed) used = length;
+	if(claimed > 0) {
+		// The characters stay where they were formatted, so the unused end
+		// can only be given back if it is the end of the last claim
+		if(!cbfifo_trim(&uart_tx_cbfifo, start, claimed, used)) {
+			memset(space + used, UART_PAD, claimed - used);
+		}
+		cbfifo_publish(&uart_tx_cbfifo);
+	}
+	if(used > 0 || length == 0) {
+		start_tx();
+		return length;
+	}
+	if(length < 0) return -1;
+
+	// Too little contiguous space, format again outside the queue
+	va_start(args, format);
+	length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if(length < 0) return -1;
+	if((size_t)length >= sizeof(line)) length = sizeof(line) - 1;
+	if(__sys_write(0, line, length) != 0) return -1;
+
+	return length;
+} // uart_printf()
+
 /**
  * @brief Reads one character from the serial connection and returns it
  *
@@ -68,7 +149,7 @@ int __sys_readc(void) {
 
 	// Dequeue one character from the Rx circular buffer and return it
 	uint8_t character;
-	cbfifo_dequeue(&uart_rx_cbfifo, &character, sizeof(character));
+	cbfifo_dequeue(&uart_rx_cbfifo, &character, 1);
 	return character;
 } // __sys_readc()
 
@@ -125,6 +206,13 @@ void uart0_init() {
  */
 void UART0_IRQHandler(void) {
 	uint8_t character;
+	uint8_t *next;
+
+	if(UART0->S2 & UART0_S2_RXEDGIF_MASK) {
+		// An Rx edge woke the MCU from a stop mode, stop watching for edges
+		UART0->BDH &= ~UART0_BDH_RXEDGIE_MASK;
+		UART0->S2 |= UART0_S2_RXEDGIF_MASK;
+	}
 
 	if(UART0->S1 & (UART_S1_OR_MASK | UART_S1_NF_MASK |
 	   UART_S1_FE_MASK | UART_S1_PF_MASK)) {
@@ -138,7 +226,7 @@ void UART0_IRQHandler(void) {
 		// Received a character
 		character = UART0->D;
 		if(!cbfifo_full(&uart_rx_cbfifo)) {
-			cbfifo_enqueue(&uart_rx_cbfifo, &character, sizeof(character));
+			cbfifo_enqueue(&uart_rx_cbfifo, &character, 1);
 		}
 		else {
 			// error - queue full.
@@ -147,10 +235,14 @@ void UART0_IRQHandler(void) {
 	}
 	if((UART0->C2 & UART0_C2_TIE_MASK) &&   // Transmitter interrupt enabled
 	   (UART0->S1 & UART0_S1_TDRE_MASK)) {  // Tx buffer empty
-		if(!cbfifo_empty(&uart_tx_cbfifo)) {
-			// Can send another character
-			cbfifo_dequeue(&uart_tx_cbfifo, &character, sizeof(character));
-			UART0->D = character;
+		// Skip the padding uart_printf() leaves in space it couldn't give back
+		while(cbfifo_peek(&uart_tx_cbfifo, 1, (void**)&next) > 0 && *next == UART_PAD) {
+			cbfifo_release(&uart_tx_cbfifo, 1);
+		}
+		if(cbfifo_peek(&uart_tx_cbfifo, 1, (void**)&next) > 0) {
+			// Can send another character, straight from the queue
+			UART0->D = *next;
+			cbfifo_release(&uart_tx_cbfifo, 1);
 		}
 		else {
 			// uart_tx_cbfifo is empty so disable transmitter interrupt
@@ -26,4 +26,19 @@ extern cbfifo_t uart_rx_cbfifo;
  */
 void uart0_init();
 
+/**
+ * @brief Formats a line straight into the Tx circular buffer, saving the
+ *        copy __sys_write() makes from the printf() buffer. If the line
+ *        doesn't fit in the contiguous free space, it is formatted in a
+ *        line buffer and written with __sys_write() instead. Lines longer
+ *        than 127 characters are cut short. Safe to call from any interrupt
+ *        priority, lines are never interleaved.
+ *
+ * @param format - printf() format string
+ * @param ...    - Values to format
+ *
+ * @return Number of characters written, -1 for failure
+ */
+int uart_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
 #endif /* UART_H_ */